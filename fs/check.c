@@ -39,6 +39,18 @@ static void fs_check() {
 	user_assert(!(bitmap[r / 32] & (1 << (r % 32))));
 	debugf("alloc_block is good\n");
 
+	// allocate a run of blocks
+	u_int n;
+	if ((r = alloc_extent(4, &n)) < 0) {
+		user_panic("alloc_extent: %d", r);
+	}
+	user_assert(n >= 1 && n <= 4);
+	for (u_int b = r; b < r + n; b++) {
+		user_assert(bits[b / 32] & (1 << (b % 32)));
+		user_assert(!(bitmap[b / 32] & (1 << (b % 32))));
+	}
+	debugf("alloc_extent is good\n");
+
 	if ((r = file_open("/not-found", &f)) < 0 && r != -E_NOT_FOUND) {
 		user_panic("file_open /not-found: %d", r);
 	} else if (r == 0) {
@@ -83,8 +95,43 @@ static void fs_check() {
 
 	strcpy((char *)blk, diff_msg);
 	file_flush(f);
-	file_close(f);
 	debugf("file rewrite is good\n");
+
+	if ((r = file_inline(f)) < 0) {
+		user_panic("file_inline: %d", r);
+	}
+	user_assert((f->f_flags & FILE_INLINE) && strecmp(f->f_data, diff_msg) == 0);
+	if ((r = file_get_block(f, 0, &blk)) < 0) {
+		user_panic("file_get_block 3: %d", r);
+	}
+	user_assert(!(f->f_flags & FILE_INLINE) && strecmp(blk, diff_msg) == 0);
+	file_close(f);
+	debugf("file_inline is good\n");
+
+	if ((r = file_create("/extents", &f)) < 0) {
+		user_panic("file_create /extents: %d", r);
+	}
+	f->f_flags = FILE_EXTENTS;
+	if ((r = file_set_size(f, 3 * BLOCK_SIZE)) < 0) {
+		user_panic("file_set_size 3: %d", r);
+	}
+	for (u_int i = 0; i < 3; i++) {
+		if ((r = file_get_block(f, i, &blk)) < 0) {
+			user_panic("file_get_block 4: %d", r);
+		}
+	}
+	n = 0;
+	for (u_int i = 0; i < f->f_nextent && i < NEXTENT_INLINE; i++) {
+		n += f->f_extents[i].fe_len;
+	}
+	user_assert(f->f_nextent >= 1 && f->f_extents[0].fe_fileblk == 0 && n == 3);
+	file_set_size(f, 0);
+	user_assert(f->f_nextent == 0);
+	file_close(f);
+	if ((r = file_remove("/extents")) < 0) {
+		user_panic("file_remove /extents: %d", r);
+	}
+	debugf("extent mapping is good\n");
 }
 
 int main() {
@@ -1,12 +1,16 @@
 #include "serv.h"
 #include <mmu.h>
 
-struct Super *super;
+struct Super *super FS_SHARED;
 
-uint32_t *bitmap;
+uint32_t *bitmap FS_SHARED;
 
 void file_flush(struct File *);
 int block_is_free(u_int);
+void write_block(u_int);
+int block_is_dirty(u_int);
+int file_map_block(struct File *, u_int, u_int *, u_int);
+void file_truncate(struct File *, u_int);
 
 // Overview:
 //  Return the virtual address of this disk block in cache.
@@ -33,33 +37,293 @@ void *block_is_mapped(u_int blockno) {
 	return NULL;
 }
 
+// Block cache bookkeeping.
+//
+// Every block mapped at DISKMAP has an entry in 'bcache', found through a hash on its
+// block number. When the cache is full, 'bcache_evict' runs a CLOCK sweep over the entries:
+// an entry used since the hand last passed gets a second chance, otherwise the block is
+// written back if dirty and unmapped.
+//
+// Blocks are never evicted while something may still point into them:
+//  - pinned blocks (the superblock, the bitmap, and blocks holding open 'File's),
+//  - blocks used by the requests being served ('File' and indirect pointers are held across
+//    'read_block' calls),
+//  - blocks also mapped by a client ('serve_map' shares the cache page). When no block is
+//    left to evict, a map fails with -E_NO_MEM, and the client gives its pages back before
+//    it asks again (see 'file_fault_entry'). Readers also unmap what they have read.
+//
+// The workers serve requests under 'fs_biglock'. A worker drops it while it reads a block
+// off the disk, so that the requests that hit the cache go on meanwhile. The block is pinned
+// and marked 'bc_loading' until its data is in.
+//
+// Dirty blocks are also kept in 'bcache_dirty', so that syncing and flushing only look at
+// them. Each dirty block records the file whose flush should write it: the file itself for
+// its data and indirect blocks, its directory for the block holding its 'File'.
+#define BCACHE_NHASH 256
+
+struct BlockCacheEntry {
+	u_int bc_blockno;
+	u_int bc_used;	 // this entry holds a cached block
+	u_int bc_ref;	 // CLOCK reference bit
+	u_int bc_pin;	 // pin count
+	u_int bc_epoch;	 // request during which the block was last used
+	u_int bc_loading; // being read off the disk
+	int bc_next;	 // next entry in the hash chain, plus one (0 ends the chain)
+	u_int bc_dirty;	 // position in 'bcache_dirty', plus one (0 if clean)
+	struct File *bc_owner; // file flushing this block, or NULL for blocks of no file
+};
+
+static struct BlockCacheEntry bcache[BCACHE_NPAGES] FS_SHARED;
+static int bcache_hash[BCACHE_NHASH] FS_SHARED; // first entry of each chain, plus one
+static struct BlockCacheEntry *bcache_dirty[BCACHE_NPAGES] FS_SHARED;
+static u_int bcache_ndirty FS_SHARED;
+static uint64_t bcache_dirty_since FS_SHARED; // clock when the dirty set last became non-empty
+static u_int bcache_hand FS_SHARED;
+static u_int bcache_epoch FS_SHARED;
+static u_int bcache_active[FS_NWORKERS] FS_SHARED; // epochs of the requests being served, or 0
+static struct BlockCacheStat bcache_stat FS_SHARED;
+
+static fs_lock_t fs_biglock FS_SHARED;
+static int fs_locked; // this env holds 'fs_biglock'
+
+// Overview:
+//  Take and release the lock over the file system state, around each request.
+void fs_enter(void) {
+	fs_lock(&fs_biglock);
+	fs_locked = 1;
+}
+
+void fs_leave(void) {
+	fs_locked = 0;
+	fs_unlock(&fs_biglock);
+}
+
+static struct BlockCacheEntry *bcache_lookup(u_int blockno) {
+	int i;
+
+	for (i = bcache_hash[blockno % BCACHE_NHASH]; i; i = bcache[i - 1].bc_next) {
+		if (bcache[i - 1].bc_blockno == blockno) {
+			return &bcache[i - 1];
+		}
+	}
+	return NULL;
+}
+
+static void bcache_touch(struct BlockCacheEntry *e) {
+	e->bc_ref = 1;
+	e->bc_epoch = bcache_epoch;
+}
+
+static void bcache_set_dirty(struct BlockCacheEntry *e, struct File *owner) {
+	if (!e->bc_dirty) {
+		if (bcache_ndirty == 0) {
+			bcache_dirty_since = uinfo->ei_clock;
+		}
+		bcache_dirty[bcache_ndirty++] = e;
+		e->bc_dirty = bcache_ndirty;
+		e->bc_owner = NULL;
+	}
+	if (owner) {
+		e->bc_owner = owner;
+	}
+}
+
+static void bcache_clear_dirty(struct BlockCacheEntry *e) {
+	struct BlockCacheEntry *last;
+
+	if (e->bc_dirty) {
+		last = bcache_dirty[--bcache_ndirty];
+		bcache_dirty[e->bc_dirty - 1] = last;
+		last->bc_dirty = e->bc_dirty;
+		e->bc_dirty = 0;
+	}
+}
+
+static void bcache_remove(struct BlockCacheEntry *e) {
+	int *pi = &bcache_hash[e->bc_blockno % BCACHE_NHASH];
+
+	bcache_clear_dirty(e);
+
+	while (&bcache[*pi - 1] != e) {
+		pi = &bcache[*pi - 1].bc_next;
+	}
+	*pi = e->bc_next;
+	e->bc_used = 0;
+	bcache_stat.bc_npages--;
+}
+
+// Overview:
+//  Make room for one more block by evicting the first unused block under the CLOCK hand.
+//
+// Post-Condition:
+//  Return 0 on success, or -E_NO_MEM if every cached block is in use.
+static int bcache_evict(void) {
+	struct BlockCacheEntry *e;
+	u_int oldest = bcache_epoch;
+	void *va;
+
+	// Blocks used since the oldest request still being served began are in use.
+	for (int i = 0; i < FS_NWORKERS; i++) {
+		if (bcache_active[i] && bcache_active[i] < oldest) {
+			oldest = bcache_active[i];
+		}
+	}
+
+	// Two full turns: the first may only clear reference bits.
+	for (int n = 0; n < 2 * BCACHE_NPAGES; n++) {
+		e = &bcache[bcache_hand];
+		bcache_hand = (bcache_hand + 1) % BCACHE_NPAGES;
+		if (!e->bc_used || e->bc_pin || e->bc_epoch >= oldest) {
+			continue;
+		}
+		va = disk_addr(e->bc_blockno);
+		if (pageref(va) > fs_nref()) {
+			continue;
+		}
+		if (e->bc_ref) {
+			e->bc_ref = 0;
+			continue;
+		}
+		if (!block_is_free(e->bc_blockno) && block_is_dirty(e->bc_blockno)) {
+			write_block(e->bc_blockno);
+			bcache_stat.bc_writebacks++;
+		}
+		panic_on(fs_page_unmap(va));
+		bcache_remove(e);
+		bcache_stat.bc_evictions++;
+		return 0;
+	}
+	return -E_NO_MEM;
+}
+
+// Overview:
+//  Allocate a page for 'blockno' at its DISKMAP address and enter it into the cache,
+//  evicting another block first if the cache is full.
+static int bcache_alloc(u_int blockno) {
+	struct BlockCacheEntry *e;
+	int i, r;
+
+	if (bcache_stat.bc_npages == BCACHE_NPAGES) {
+		try(bcache_evict());
+	}
+	for (i = 0; bcache[i].bc_used; i++) {
+	}
+	try(fs_page_alloc(disk_addr(blockno)));
+
+	e = &bcache[i];
+	e->bc_blockno = blockno;
+	e->bc_used = 1;
+	e->bc_pin = 0;
+	e->bc_loading = 0;
+	e->bc_dirty = 0;
+	e->bc_next = bcache_hash[blockno % BCACHE_NHASH];
+	bcache_hash[blockno % BCACHE_NHASH] = i + 1;
+	bcache_touch(e);
+	bcache_stat.bc_npages++;
+	return 0;
+}
+
+// Overview:
+//  Read the 'n' consecutive disk blocks starting at 'blockno', just entered into the cache
+//  by 'bcache_alloc', with a single multi-sector read. A worker lets the others go on while
+//  it waits for the disk: the blocks stay pinned and marked loading until their data is in.
+static void bcache_load(u_int blockno, u_int n) {
+	u_int i;
+
+	if (!fs_locked) {
+		ide_read(0, blockno * SECT2BLK, disk_addr(blockno), n * SECT2BLK);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		struct BlockCacheEntry *e = bcache_lookup(blockno + i);
+		e->bc_loading = 1;
+		e->bc_pin++;
+	}
+	fs_leave();
+	ide_read(0, blockno * SECT2BLK, disk_addr(blockno), n * SECT2BLK);
+	fs_enter();
+	for (i = 0; i < n; i++) {
+		struct BlockCacheEntry *e = bcache_lookup(blockno + i);
+		e->bc_loading = 0;
+		e->bc_pin--;
+	}
+}
+
 // Overview:
-//  Check if this virtual address is dirty. (check PTE_DIRTY bit)
-int va_is_dirty(void *va) {
-	return vpt[VPN(va)] & PTE_DIRTY;
+//  Return the block number of the cache page containing 'va'.
+u_int disk_blockno(void *va) {
+	return ((u_int)va - DISKMAP) / BLOCK_SIZE;
+}
+
+// Overview:
+//  Keep the cached block 'blockno' in memory until the matching 'block_unpin'.
+void block_pin(u_int blockno) {
+	struct BlockCacheEntry *e = bcache_lookup(blockno);
+
+	user_assert(e != NULL);
+	e->bc_pin++;
+}
+
+void block_unpin(u_int blockno) {
+	struct BlockCacheEntry *e = bcache_lookup(blockno);
+
+	user_assert(e != NULL && e->bc_pin > 0);
+	e->bc_pin--;
+}
+
+// Overview:
+//  Called by a worker before each request. Blocks used by the requests that ended before it
+//  become candidates for eviction again.
+//
+// Post-Condition:
+//  Return the slot of the request, to be passed to 'block_cache_end_request'.
+u_int block_cache_begin_request(void) {
+	u_int i;
+
+	for (i = 0; bcache_active[i]; i++) {
+	}
+	bcache_active[i] = ++bcache_epoch;
+	return i;
+}
+
+void block_cache_end_request(u_int slot) {
+	bcache_active[slot] = 0;
+}
+
+void block_cache_stat(struct BlockCacheStat *stat) {
+	*stat = bcache_stat;
 }
 
 // Overview:
-//  Check if this block is dirty. (check corresponding `va`)
+//  Check if this block is dirty.
 int block_is_dirty(u_int blockno) {
-	void *va = disk_addr(blockno);
-	return va_is_mapped(va) && va_is_dirty(va);
+	struct BlockCacheEntry *e = bcache_lookup(blockno);
+	return e && e->bc_dirty;
 }
 
 // Overview:
 //  Mark this block as dirty (cache page has changed and needs to be written back to disk).
-int dirty_block(u_int blockno) {
-	void *va = disk_addr(blockno);
+//  If 'owner' is not NULL, the block is written back by 'file_flush(owner)'.
+static int dirty_block_of(u_int blockno, struct File *owner) {
+	struct BlockCacheEntry *e = bcache_lookup(blockno);
 
-	if (!va_is_mapped(va)) {
+	if (e == NULL) {
 		return -E_NOT_FOUND;
 	}
+	bcache_set_dirty(e, owner);
+	return 0;
+}
 
-	if (va_is_dirty(va)) {
-		return 0;
-	}
+int dirty_block(u_int blockno) {
+	return dirty_block_of(blockno, NULL);
+}
 
-	return syscall_mem_map(0, va, 0, va, PTE_D | PTE_DIRTY);
+// Overview:
+//  Mark the cache block containing 'va' dirty after the server changed it in place (a 'File',
+//  an indirect block or the bitmap). Otherwise the change would be lost if the block were
+//  evicted from the cache.
+static void dirty_addr(void *va, struct File *owner) {
+	panic_on(dirty_block_of(disk_blockno(va), owner));
 }
 
 // Overview:
@@ -73,6 +337,48 @@ void write_block(u_int blockno) {
 	// Step2: write data to IDE disk. (using ide_write, and the diskno is 0)
 	void *va = disk_addr(blockno);
 	ide_write(0, blockno * SECT2BLK, va, SECT2BLK);
+
+	struct BlockCacheEntry *e = bcache_lookup(blockno);
+	if (e) {
+		bcache_clear_dirty(e);
+	}
+}
+
+// Overview:
+//  Write out all dirty blocks if 'all' is set, otherwise those owned by 'owner'.
+//  Blocks are written in increasing order, and runs of consecutive blocks (which are also
+//  contiguous at DISKMAP) go out as a single multi-sector write.
+static void flush_dirty(int all, struct File *owner) {
+	static u_int bnos[BCACHE_NPAGES];
+	struct BlockCacheEntry *e;
+	u_int n = 0, i, j, bno;
+
+	for (i = 0; i < bcache_ndirty;) {
+		e = bcache_dirty[i];
+		if (!all && e->bc_owner != owner) {
+			i++;
+			continue;
+		}
+		bcache_clear_dirty(e); // moves the last dirty entry into slot 'i'
+		if (!block_is_free(e->bc_blockno)) {
+			bnos[n++] = e->bc_blockno;
+		}
+	}
+
+	// Insertion sort: the set is usually small and often nearly sorted already.
+	for (i = 1; i < n; i++) {
+		bno = bnos[i];
+		for (j = i; j > 0 && bnos[j - 1] > bno; j--) {
+			bnos[j] = bnos[j - 1];
+		}
+		bnos[j] = bno;
+	}
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && bnos[j] == bnos[j - 1] + 1; j++) {
+		}
+		ide_write(0, bnos[i] * SECT2BLK, disk_addr(bnos[i]), (j - i) * SECT2BLK);
+	}
 }
 
 // Overview:
@@ -113,16 +419,26 @@ int read_block(u_int blockno, void **blk, u_int *isnew) {
 	//  If this block is already mapped, just set *isnew, else alloc memory and
 	//  read data from IDE disk (use `syscall_mem_alloc` and `ide_read`).
 	//  We have only one IDE disk, so the diskno of ide_read should be 0.
-	if (block_is_mapped(blockno)) { // the block is in memory
+	struct BlockCacheEntry *e = bcache_lookup(blockno);
+	if (e) { // the block is in memory
 		if (isnew) {
 			*isnew = 0;
 		}
+		// Another worker may still be reading it off the disk.
+		while (e->bc_loading) {
+			fs_leave();
+			syscall_yield();
+			fs_enter();
+		}
+		bcache_touch(e);
+		bcache_stat.bc_hits++;
 	} else { // the block is not in memory
 		if (isnew) {
 			*isnew = 1;
 		}
-		try(syscall_mem_alloc(0, va, PTE_D));
-		ide_read(0, blockno * SECT2BLK, va, SECT2BLK);
+		try(bcache_alloc(blockno));
+		bcache_load(blockno, 1);
+		bcache_stat.bc_misses++;
 	}
 
 	// Step 5: if blk != NULL, assign 'va' to '*blk'.
@@ -138,13 +454,15 @@ int map_block(u_int blockno) {
 	// Step 1: If the block is already mapped in cache, return 0.
 	// Hint: Use 'block_is_mapped'.
 	/* Exercise 5.7: Your code here. (1/5) */
-	if (block_is_mapped(blockno)) {
+	struct BlockCacheEntry *e = bcache_lookup(blockno);
+	if (e) {
+		bcache_touch(e);
 		return 0;
 	}
 	// Step 2: Alloc a page in permission 'PTE_D' via syscall.
 	// Hint: Use 'disk_addr' for the virtual address.
 	/* Exercise 5.7: Your code here. (2/5) */
-	return syscall_mem_alloc(0, disk_addr(blockno), PTE_D);
+	return bcache_alloc(blockno);
 }
 
 // Overview:
@@ -163,8 +481,12 @@ void unmap_block(u_int blockno) {
 	}
 	// Step 3: Unmap the virtual address via syscall.
 	/* Exercise 5.7: Your code here. (5/5) */
-	syscall_mem_unmap(0, disk_addr(blockno));
+	fs_page_unmap(disk_addr(blockno));
 	user_assert(!block_is_mapped(blockno));
+	struct BlockCacheEntry *e = bcache_lookup(blockno);
+	if (e) {
+		bcache_remove(e);
+	}
 }
 
 // Overview:
@@ -184,19 +506,126 @@ int block_is_free(u_int blockno) {
 	return 0;
 }
 
+// Free space summary, above the bitmap: the number of free blocks in each bitmap word and in
+// each bitmap block, so that allocation steps over full regions without testing their bits.
+// It is built by 'read_bitmap' and kept up to date by 'bmap_take' and 'free_block'.
+// Allocation is next-fit: it starts where the previous one ended.
+#define BMAP_NWORDS (DISKMAX / BLOCK_SIZE / 32)
+#define BMAP_NBLOCKS (DISKMAX / BLOCK_SIZE / BLOCK_SIZE_BIT)
+
+static uint8_t bmap_wfree[BMAP_NWORDS] FS_SHARED;   // free blocks in each bitmap word
+static uint16_t bmap_bfree[BMAP_NBLOCKS] FS_SHARED; // free blocks in each bitmap block
+static u_int bmap_hint FS_SHARED;		    // where the next search starts
+
+// Blocks a search goes past the hint, once it has found some free run, before it settles
+// for the longest run found instead of one of the length asked for. On a fragmented disk
+// with no run that long, this keeps a search from testing the whole bitmap bit by bit.
+#define BMAP_SCAN_MAX 1024
+
 // Overview:
 //  Mark a block as free in the bitmap.
 void free_block(u_int blockno) {
 	// You can refer to the function 'block_is_free' above.
 	// Step 1: If 'blockno' is invalid (0 or >= the number of blocks in 'super'), return.
 	/* Exercise 5.4: Your code here. (1/2) */
-	if (blockno == 0 || blockno >= super->s_nblocks) {
+	if (blockno == 0 || blockno >= super->s_nblocks || block_is_free(blockno)) {
 		return;
 	}
 	// Step 2: Set the flag bit of 'blockno' in 'bitmap'.
 	// Hint: Use bit operations to update the bitmap, such as b[n / W] |= 1 << (n % W).
 	/* Exercise 5.4: Your code here. (2/2) */
 	bitmap[blockno / 32] |= 1 << (blockno % 32);
+	dirty_addr(&bitmap[blockno / 32], NULL);
+	bmap_wfree[blockno / 32]++;
+	bmap_bfree[blockno / BLOCK_SIZE_BIT]++;
+}
+
+// Overview:
+//  Mark the 'n' free blocks starting at 'start' as used. The bitmap blocks are only marked
+//  dirty; they reach the disk with the next write-back.
+static void bmap_take(u_int start, u_int n) {
+	for (u_int b = start; b < start + n; b++) {
+		bitmap[b / 32] &= ~(1 << (b % 32));
+		dirty_addr(&bitmap[b / 32], NULL);
+		bmap_wfree[b / 32]--;
+		bmap_bfree[b / BLOCK_SIZE_BIT]--;
+	}
+	bmap_hint = start + n < super->s_nblocks ? start + n : 3;
+}
+
+// Overview:
+//  Count the free blocks starting at 'start', up to 'n'.
+static u_int bmap_free_run(u_int start, u_int n) {
+	u_int len = 0;
+
+	while (len < n && start + len < super->s_nblocks && block_is_free(start + len)) {
+		len++;
+	}
+	return len;
+}
+
+// Overview:
+//  Allocate a run of up to 'n' contiguous free blocks. The first run of 'n' blocks found from
+//  the next-fit hint on is taken, or the longest shorter one found within BMAP_SCAN_MAX
+//  blocks of the hint (or up to the first free block, if that is further).
+//
+// Post-Condition:
+//  Return the first block number of the run and set '*nalloc' to its length (at least 1).
+//  Return -E_NO_DISK if we are out of blocks.
+int alloc_extent(u_int n, u_int *nalloc) {
+	u_int nblocks = super->s_nblocks;
+	u_int b = bmap_hint, scanned = 0;
+	u_int run = 0, runstart = 0, best = 0, bestlen = 0;
+
+	while (scanned < nblocks && bestlen < n && (bestlen == 0 || scanned < BMAP_SCAN_MAX)) {
+		if (b >= nblocks) {
+			b = 3;
+			run = 0;
+		}
+		if (b % BLOCK_SIZE_BIT == 0 && bmap_bfree[b / BLOCK_SIZE_BIT] == 0) {
+			// A whole bitmap block of used blocks.
+			run = 0;
+			b += BLOCK_SIZE_BIT;
+			scanned += BLOCK_SIZE_BIT;
+			continue;
+		}
+		if (b % 32 == 0 && bmap_wfree[b / 32] == 0) {
+			run = 0;
+			b += 32;
+			scanned += 32;
+			continue;
+		}
+		if (b % 32 == 0 && bmap_wfree[b / 32] == 32 && b + 32 <= nblocks) {
+			if (run == 0) {
+				runstart = b;
+			}
+			run += 32;
+			b += 32;
+			scanned += 32;
+		} else {
+			if (block_is_free(b)) {
+				if (run == 0) {
+					runstart = b;
+				}
+				run++;
+			} else {
+				run = 0;
+			}
+			b++;
+			scanned++;
+		}
+		if (run > bestlen) {
+			best = runstart;
+			bestlen = run;
+		}
+	}
+
+	if (bestlen == 0) {
+		return -E_NO_DISK;
+	}
+	*nalloc = MIN(bestlen, n);
+	bmap_take(best, *nalloc);
+	return best;
 }
 
 // Overview:
@@ -206,18 +635,9 @@ void free_block(u_int blockno) {
 //  Return block number allocated on success,
 //  Return -E_NO_DISK if we are out of blocks.
 int alloc_block_num(void) {
-	int blockno;
-	// walk through this bitmap, find a free one and mark it as used, then sync
-	// this block to IDE disk (using `write_block`) from memory.
-	for (blockno = 3; blockno < super->s_nblocks; blockno++) {
-		if (bitmap[blockno / 32] & (1 << (blockno % 32))) { // the block is free
-			bitmap[blockno / 32] &= ~(1 << (blockno % 32));
-			write_block(blockno / BLOCK_SIZE_BIT + 2); // write to disk.
-			return blockno;
-		}
-	}
-	// no free blocks.
-	return -E_NO_DISK;
+	u_int n;
+
+	return alloc_extent(1, &n);
 }
 
 // Overview:
@@ -230,11 +650,13 @@ int alloc_block(void) {
 	}
 	bno = r;
 
-	// Step 2: map this block into memory.
+	// Step 2: map this block into memory. A freed block may still be cached with its old
+	// contents, so start from zeros.
 	if ((r = map_block(bno)) < 0) {
 		free_block(bno);
 		return r;
 	}
+	memset(disk_addr(bno), 0, BLOCK_SIZE);
 
 	// Step 3: return block number.
 	return bno;
@@ -284,6 +706,7 @@ void read_bitmap(void) {
 	u_int nbitmap = super->s_nblocks / BLOCK_SIZE_BIT + 1;
 	for (i = 0; i < nbitmap; i++) {
 		read_block(i + 2, blk, 0);
+		block_pin(i + 2);
 	}
 
 	bitmap = disk_addr(2);
@@ -298,6 +721,15 @@ void read_bitmap(void) {
 		user_assert(!block_is_free(i + 2));
 	}
 
+	// Step 4: Build the free space summary.
+	bmap_hint = 3;
+	for (i = 0; i < super->s_nblocks; i++) {
+		if (block_is_free(i)) {
+			bmap_wfree[i / 32]++;
+			bmap_bfree[i / BLOCK_SIZE_BIT]++;
+		}
+	}
+
 	debugf("read_bitmap is good\n");
 }
 
@@ -317,8 +749,7 @@ void check_write_block(void) {
 	user_assert(block_is_mapped(1));
 
 	// clear it out
-	panic_on(syscall_mem_unmap(0, disk_addr(1)));
-	user_assert(!block_is_mapped(1));
+	unmap_block(1);
 
 	// validate the data read from the disk.
 	panic_on(read_block(1, 0, 0));
@@ -337,58 +768,420 @@ void check_write_block(void) {
 //  2. check if the disk can work.
 //  3. read bitmap blocks from disk to memory.
 void fs_init(void) {
+	bcache_stat.bc_budget = BCACHE_NPAGES;
 	read_super();
 	check_write_block();
 	read_bitmap();
+	// 'super' points into block 1 from now on.
+	block_pin(1);
+}
+
+// Overview:
+//  Read the indirect block whose number is stored at 'pbno' into memory and set '*blk' to
+//  it. When there is none and 'alloc' is set, allocate a zeroed one first; 'owner' is the
+//  file whose metadata block holds 'pbno'.
+//
+// Post-Condition:
+//  Return 0 on success, -E_NOT_FOUND if there is no such block and 'alloc' is 0, or the
+//  error of 'alloc_block' / 'read_block'.
+static int indirect_block(uint32_t *pbno, struct File *owner, struct File *f, u_int alloc,
+			  uint32_t **blk) {
+	int r;
+
+	if (*pbno == 0) {
+		if (alloc == 0) {
+			return -E_NOT_FOUND;
+		}
+		if ((r = alloc_block()) < 0) {
+			return r;
+		}
+		dirty_block_of(r, f);
+		*pbno = r;
+		dirty_addr(pbno, owner);
+	}
+	return read_block(*pbno, (void **)blk, 0);
 }
 
 // Overview:
 //  Like pgdir_walk but for files.
 //  Find the disk block number slot for the 'filebno'th block in file 'f'. Then, set
 //  '*ppdiskbno' to point to that slot. The slot will be one of the f->f_direct[] entries,
-//  or an entry in the indirect block.
-//  When 'alloc' is set, this function will allocate an indirect block if necessary.
+//  or an entry in the indirect block. Blocks past the first NINDIRECT are reached through
+//  the double indirect block 'f_indirect2' and then the triple indirect block 'f_indirect3'.
+//  When 'alloc' is set, this function will allocate indirect blocks if necessary.
 //
 // Post-Condition:
 //  Return 0 on success, and set *ppdiskbno to the pointer to the target block.
 //  Return -E_NOT_FOUND if the function needed to allocate an indirect block, but alloc was 0.
 //  Return -E_NO_DISK if there's no space on the disk for an indirect block.
 //  Return -E_NO_MEM if there's not enough memory for an indirect block.
-//  Return -E_INVAL if filebno is out of range (>= NINDIRECT).
+//  Return -E_INVAL if filebno is out of range (>= NINDIRECT + NINDIRECT2 + NINDIRECT3).
 int file_block_walk(struct File *f, u_int filebno, uint32_t **ppdiskbno, u_int alloc) {
 	int r;
+	u_int span;
 	uint32_t *ptr;
 	uint32_t *blk;
 
 	if (filebno < NDIRECT) {
 		// Step 1: if the target block is corresponded to a direct pointer, just return the
 		// disk block number.
-		ptr = &f->f_direct[filebno];
-	} else if (filebno < NINDIRECT) {
-		// Step 2: if the target block is corresponded to the indirect block, but there's no
-		//  indirect block and `alloc` is set, create the indirect block.
-		if (f->f_indirect == 0) {
-			if (alloc == 0) {
-				return -E_NOT_FOUND;
-			}
+		*ppdiskbno = &f->f_direct[filebno];
+		return 0;
+	}
+
+	// Step 2: pick the tree the block is in. Its root pointer lives in the 'File'.
+	if (filebno < NINDIRECT) {
+		ptr = &f->f_indirect;
+		span = 1;
+	} else if ((filebno -= NINDIRECT) < NINDIRECT2) {
+		ptr = &f->f_indirect2;
+		span = NINDIRECT;
+	} else if ((filebno -= NINDIRECT2) < NINDIRECT3) {
+		ptr = &f->f_indirect3;
+		span = NINDIRECT2;
+	} else {
+		return -E_INVAL;
+	}
+
+	// Step 3: walk down the tree, creating the missing indirect blocks if 'alloc' is set.
+	// 'span' is the number of file blocks behind each entry of the current indirect block.
+	// Only the root pointer is in the 'File' block, all the others are in blocks of 'f'.
+	for (struct File *owner = f->f_dir; span > 0; span /= NINDIRECT, owner = f) {
+		if ((r = indirect_block(ptr, owner, f, alloc, &blk)) < 0) {
+			return r;
+		}
+		ptr = blk + filebno / span % NINDIRECT;
+	}
+
+	// Step 4: store the result into *ppdiskbno, and return 0.
+	*ppdiskbno = ptr;
+	return 0;
+}
+
+// Max number of blocks given to a file by one allocation.
+#define FILE_EXTENT_MAX 16
+
+// Overview:
+//  Prepare the new disk block 'blockno' of 'f': it starts zeroed and dirty, so that nothing
+//  left on the disk shows through.
+static int file_init_block(struct File *f, u_int blockno) {
+	int r;
+
+	if ((r = map_block(blockno)) < 0) {
+		return r;
+	}
+	memset(disk_addr(blockno), 0, BLOCK_SIZE);
+	dirty_block_of(blockno, f);
+	return 0;
+}
+
+// Overview:
+//  Give the new disk block 'blockno' to block 'filebno' of 'f', whose pointer is at 'ptr'.
+static int file_attach_block(struct File *f, u_int filebno, uint32_t *ptr, u_int blockno) {
+	int r;
+
+	if ((r = file_init_block(f, blockno)) < 0) {
+		return r;
+	}
+	*ptr = blockno;
+	dirty_addr(ptr, filebno < NDIRECT ? f->f_dir : f);
+	return 0;
+}
 
-			if ((r = alloc_block()) < 0) {
-				return r;
+// Overview:
+//  Allocate a disk block for block 'filebno' of 'f', whose (zero) pointer is at 'ptr'.
+//  Blocks are allocated as a run for 'filebno' and the following blocks of the file that
+//  have none yet, up to the end of the file: the run continues right after the disk block of
+//  'filebno' - 1 if that is free, and is found by 'alloc_extent' otherwise. So a file that
+//  grows sequentially ends up contiguous on disk.
+static int file_alloc_blocks(struct File *f, u_int filebno, uint32_t *ptr) {
+	u_int nblocks = ROUND(f->f_size, BLOCK_SIZE) / BLOCK_SIZE;
+	u_int want = 1, n, start, prev;
+	uint32_t *p;
+	int r;
+
+	// Count the blocks without a disk block from 'filebno' on.
+	while (want < FILE_EXTENT_MAX && filebno + want < nblocks) {
+		r = file_block_walk(f, filebno + want, &p, 0);
+		if (r != -E_NOT_FOUND && (r < 0 || *p != 0)) {
+			break;
+		}
+		want++;
+	}
+
+	if (filebno > 0 && file_map_block(f, filebno - 1, &prev, 0) == 0 &&
+	    (n = bmap_free_run(prev + 1, want)) > 0) {
+		start = prev + 1;
+		bmap_take(start, n);
+	} else if ((r = alloc_extent(want, &n)) < 0) {
+		return r;
+	} else {
+		start = r;
+	}
+
+	if ((r = file_attach_block(f, filebno, ptr, start)) < 0) {
+		// Give the whole run back: all of it was taken from the bitmap.
+		for (u_int i = 0; i < n; i++) {
+			free_block(start + i);
+		}
+		return r;
+	}
+	for (u_int i = 1; i < n; i++) {
+		// The run is only a hint for the following blocks: if one can't be attached now,
+		// it is given back and allocated again when the block is first used.
+		if (file_block_walk(f, filebno + i, &p, 1) < 0 || *p != 0 ||
+		    file_attach_block(f, filebno + i, p, start + i) < 0) {
+			for (; i < n; i++) {
+				free_block(start + i);
 			}
-			f->f_indirect = r;
 		}
+	}
+	return r;
+}
+
+// Overview:
+//  Return extent 'i' of the extent-mapped file 'f', whose extent block is at 'blk'.
+static struct FileExtent *file_extent(struct File *f, struct FileExtent *blk, u_int i) {
+	return i < NEXTENT_INLINE ? &f->f_extents[i] : &blk[i - NEXTENT_INLINE];
+}
+
+// Overview:
+//  Mark the block holding extent 'e' of 'f' dirty: the 'File' itself or its extent block.
+static void file_extent_dirty(struct File *f, struct FileExtent *e) {
+	dirty_addr(e, (e >= f->f_extents && e < f->f_extents + NEXTENT_INLINE) ? f->f_dir : f);
+}
+
+// Overview:
+//  Find the extent of 'f' that may hold block 'filebno' by a binary search.
+//
+// Post-Condition:
+//  Return 0 and set '*pi' to the index of the last extent starting at or before 'filebno'
+//  (-1 if there is none), and '*blk' to the extent block of 'f' (NULL if it has none).
+//  Return the error of 'read_block' otherwise.
+static int file_extent_find(struct File *f, u_int filebno, struct FileExtent **blk, int *pi) {
+	int lo = 0, hi = f->f_nextent;
+	int r;
+
+	*blk = NULL;
+	if (f->f_extblock && (r = read_block(f->f_extblock, (void **)blk, 0)) < 0) {
+		return r;
+	}
+	// Extents [0, lo) start at or before 'filebno', extents [hi, f_nextent) after it.
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (file_extent(f, *blk, mid)->fe_fileblk <= filebno) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*pi = lo - 1;
+	return 0;
+}
 
-		// Step 3: read the new indirect block to memory.
-		if ((r = read_block(f->f_indirect, (void **)&blk, 0)) < 0) {
+// Overview:
+//  Insert extent 'ne' at index 'i' of 'f', moving the following ones up. The extent block is
+//  allocated when the inline extents are all used.
+//
+// Post-Condition:
+//  Return 0 on success, -E_NO_DISK if 'f' has NEXTENT extents already, or the error of
+//  'alloc_block'.
+static int file_extent_insert(struct File *f, struct FileExtent **blk, u_int i,
+			      struct FileExtent *ne) {
+	struct FileExtent *e;
+	int r;
+
+	if (f->f_nextent == NEXTENT) {
+		return -E_NO_DISK;
+	}
+	if (f->f_nextent >= NEXTENT_INLINE && f->f_extblock == 0) {
+		if ((r = alloc_block()) < 0) {
 			return r;
 		}
-		ptr = blk + filebno;
+		dirty_block_of(r, f);
+		f->f_extblock = r;
+		*blk = disk_addr(r);
+	}
+	for (u_int j = f->f_nextent; j > i; j--) {
+		e = file_extent(f, *blk, j);
+		*e = *file_extent(f, *blk, j - 1);
+		file_extent_dirty(f, e);
+	}
+	e = file_extent(f, *blk, i);
+	*e = *ne;
+	file_extent_dirty(f, e);
+	f->f_nextent++;
+	dirty_addr(f, f->f_dir);
+	return 0;
+}
+
+// Overview:
+//  'file_map_block' for extent-mapped files. A missing block is allocated as a run with the
+//  following blocks, up to the next extent or the end of the file. The extent before it
+//  just grows when it ends right before 'filebno' and the disk blocks after it are free, so
+//  a file written sequentially keeps a single extent.
+static int file_extent_map(struct File *f, u_int filebno, u_int *diskbno, u_int alloc) {
+	struct FileExtent *blk, *e = NULL, ne;
+	u_int nblocks = ROUND(f->f_size, BLOCK_SIZE) / BLOCK_SIZE;
+	u_int want, n, start, k;
+	int i, r;
+
+	// Step 1: find the extent holding 'filebno'.
+	if ((r = file_extent_find(f, filebno, &blk, &i)) < 0) {
+		return r;
+	}
+	if (i >= 0) {
+		e = file_extent(f, blk, i);
+		if (filebno - e->fe_fileblk < e->fe_len) {
+			*diskbno = e->fe_diskblk + (filebno - e->fe_fileblk);
+			return 0;
+		}
+	}
+	if (alloc == 0) {
+		return -E_NOT_FOUND;
+	}
+
+	// Step 2: allocate the run, right after the previous extent if possible.
+	want = MIN(FILE_EXTENT_MAX, MAX(nblocks, filebno + 1) - filebno);
+	if (i + 1 < f->f_nextent) {
+		want = MIN(want, file_extent(f, blk, i + 1)->fe_fileblk - filebno);
+	}
+	if (e != NULL && e->fe_fileblk + e->fe_len == filebno &&
+	    (n = bmap_free_run(e->fe_diskblk + e->fe_len, want)) > 0) {
+		start = e->fe_diskblk + e->fe_len;
+		bmap_take(start, n);
+	} else if ((r = alloc_extent(want, &n)) < 0) {
+		return r;
 	} else {
+		start = r;
+	}
+
+	// Step 3: zero the new blocks, and give back those we can't.
+	for (k = 0; k < n; k++) {
+		if ((r = file_init_block(f, start + k)) < 0) {
+			break;
+		}
+	}
+	for (u_int b = k; b < n; b++) {
+		free_block(start + b);
+	}
+	if ((n = k) == 0) {
+		return r;
+	}
+
+	// Step 4: record the run.
+	if (e != NULL && e->fe_fileblk + e->fe_len == filebno && e->fe_diskblk + e->fe_len == start) {
+		e->fe_len += n;
+		file_extent_dirty(f, e);
+	} else {
+		ne = (struct FileExtent){filebno, start, n};
+		if ((r = file_extent_insert(f, &blk, i + 1, &ne)) < 0) {
+			for (k = 0; k < n; k++) {
+				free_block(start + k);
+			}
+			return r;
+		}
+	}
+	*diskbno = start;
+	return 0;
+}
+
+// Overview:
+//  'file_truncate' for extent-mapped files: free the blocks from 'nblocks' on, dropping the
+//  extents left empty, and the extent block once the inline extents are enough.
+static void file_extent_truncate(struct File *f, u_int nblocks) {
+	struct FileExtent *blk = NULL, *e;
+	u_int keep;
+
+	if (f->f_extblock) {
+		panic_on(read_block(f->f_extblock, (void **)&blk, 0));
+	}
+	while (f->f_nextent > 0) {
+		e = file_extent(f, blk, f->f_nextent - 1);
+		if (e->fe_fileblk + e->fe_len <= nblocks) {
+			break;
+		}
+		keep = e->fe_fileblk < nblocks ? nblocks - e->fe_fileblk : 0;
+		for (u_int b = keep; b < e->fe_len; b++) {
+			free_block(e->fe_diskblk + b);
+		}
+		if (keep > 0) {
+			e->fe_len = keep;
+			file_extent_dirty(f, e);
+			break;
+		}
+		f->f_nextent--;
+	}
+	if (f->f_nextent <= NEXTENT_INLINE && f->f_extblock) {
+		free_block(f->f_extblock);
+		f->f_extblock = 0;
+	}
+}
+
+// Overview:
+//  Move the data of the inline file 'f' out to a block of its own, before the file is mapped
+//  or grows past FILE_INLINE_MAX bytes. 'f' uses block pointers from then on.
+//
+// Post-Condition:
+//  Return 0 on success (or if 'f' is not inline), or the error of 'file_map_block'.
+int file_spill(struct File *f) {
+	char data[FILE_INLINE_MAX];
+	u_int diskbno;
+	int r;
+
+	if (!(f->f_flags & FILE_INLINE)) {
+		return 0;
+	}
+	memcpy(data, f->f_data, sizeof(data));
+	memset(f->f_data, 0, sizeof(f->f_data));
+	f->f_flags &= ~FILE_INLINE;
+	dirty_addr(f, f->f_dir);
+	if (f->f_size == 0) {
+		return 0;
+	}
+
+	// The new block is mapped, zeroed and dirty.
+	if ((r = file_map_block(f, 0, &diskbno, 1)) < 0) {
+		memcpy(f->f_data, data, sizeof(data));
+		f->f_flags |= FILE_INLINE;
+		return r;
+	}
+	memcpy(disk_addr(diskbno), data, f->f_size);
+	return 0;
+}
+
+// Overview:
+//  Move the data of the small regular file 'f' into the 'File' itself and free its blocks, so
+//  that reading it costs no disk read besides that of the block holding its 'File'.
+//
+// Post-Condition:
+//  Return 0 on success, -E_INVAL if 'f' is not a regular file of at most FILE_INLINE_MAX
+//  bytes, or the error of 'read_block'.
+int file_inline(struct File *f) {
+	char data[FILE_INLINE_MAX];
+	u_int size = f->f_size, diskbno;
+	void *blk;
+	int r;
+
+	if (f->f_type != FTYPE_REG || size > FILE_INLINE_MAX) {
 		return -E_INVAL;
 	}
+	if (f->f_flags & FILE_INLINE) {
+		return 0;
+	}
 
-	// Step 4: store the result into *ppdiskbno, and return 0.
-	*ppdiskbno = ptr;
+	memset(data, 0, sizeof(data));
+	if (size > 0 && file_map_block(f, 0, &diskbno, 0) == 0) {
+		if ((r = read_block(diskbno, &blk, 0)) < 0) {
+			return r;
+		}
+		memcpy(data, blk, size);
+	}
+	file_truncate(f, 0);
+	memcpy(f->f_data, data, sizeof(data));
+	f->f_flags = (f->f_flags & ~FILE_EXTENTS) | FILE_INLINE;
+	f->f_size = size;
+	dirty_addr(f, f->f_dir);
 	return 0;
 }
 
@@ -407,6 +1200,19 @@ int file_map_block(struct File *f, u_int filebno, u_int *diskbno, u_int alloc) {
 	int r;
 	uint32_t *ptr;
 
+	if (f->f_flags & FILE_INLINE) {
+		// The data has no block yet: move it to one first.
+		if (alloc == 0) {
+			return -E_NOT_FOUND;
+		}
+		if ((r = file_spill(f)) < 0) {
+			return r;
+		}
+	}
+	if (f->f_flags & FILE_EXTENTS) {
+		return file_extent_map(f, filebno, diskbno, alloc);
+	}
+
 	// Step 1: find the pointer for the target block.
 	if ((r = file_block_walk(f, filebno, &ptr, alloc)) < 0) {
 		return r;
@@ -418,10 +1224,9 @@ int file_map_block(struct File *f, u_int filebno, u_int *diskbno, u_int alloc) {
 			return -E_NOT_FOUND;
 		}
 
-		if ((r = alloc_block()) < 0) {
+		if ((r = file_alloc_blocks(f, filebno, ptr)) < 0) {
 			return r;
 		}
-		*ptr = r;
 	}
 
 	// Step 3: set the pointer to the block in *diskbno and return 0.
@@ -436,12 +1241,14 @@ int file_clear_block(struct File *f, u_int filebno) {
 	uint32_t *ptr;
 
 	if ((r = file_block_walk(f, filebno, &ptr, 0)) < 0) {
-		return r;
+		// No indirect block on the way, so no block either.
+		return r == -E_NOT_FOUND ? 0 : r;
 	}
 
 	if (*ptr) {
 		free_block(*ptr);
 		*ptr = 0;
+		dirty_addr(ptr, filebno < NDIRECT ? f->f_dir : f);
 	}
 
 	return 0;
@@ -471,6 +1278,44 @@ int file_get_block(struct File *f, u_int filebno, void **blk) {
 	return 0;
 }
 
+// Overview:
+//  Read the 'n' consecutive disk blocks starting at 'blockno', already entered into the
+//  cache by 'bcache_alloc', with a single multi-sector read.
+static void read_ahead_run(u_int blockno, u_int n) {
+	if (n) {
+		bcache_load(blockno, n);
+		bcache_stat.bc_readahead += n;
+	}
+}
+
+// Overview:
+//  Read ahead: bring the existing blocks among the 'n' blocks of file f starting at
+//  'filebno' into the cache. Blocks already cached are skipped, and each run of consecutive
+//  disk blocks that are not is read with one 'ide_read'. Stop early if the cache is full of
+//  blocks in use.
+void file_prefetch(struct File *f, u_int filebno, u_int n) {
+	u_int nblocks = ROUND(f->f_size, BLOCK_SIZE) / BLOCK_SIZE;
+	u_int end = MIN(filebno + n, nblocks);
+	u_int start = 0, len = 0, diskbno;
+
+	for (u_int i = filebno; i < end; i++) {
+		if (file_map_block(f, i, &diskbno, 0) < 0 || bcache_lookup(diskbno)) {
+			continue;
+		}
+		if (len && diskbno != start + len) {
+			read_ahead_run(start, len);
+			len = 0;
+		}
+		if (bcache_alloc(diskbno) < 0) {
+			break;
+		}
+		if (len++ == 0) {
+			start = diskbno;
+		}
+	}
+	read_ahead_run(start, len);
+}
+
 // Overview:
 //  Mark the offset/BLOCK_SIZE'th block dirty in file f.
 int file_dirty(struct File *f, u_int offset) {
@@ -481,7 +1326,114 @@ int file_dirty(struct File *f, u_int offset) {
 		return r;
 	}
 
-	return dirty_block(diskbno);
+	return dirty_block_of(diskbno, f);
+}
+
+// Overview:
+//  Copy 'len' bytes of file 'src' from offset 'soff' on to file 'dst' at offset 'doff', block
+//  by block, without the data leaving the block cache. Holes of 'src' read as zeros.
+//
+// Pre-Condition:
+//  'dst' is not inline.
+//
+// Post-Condition:
+//  Return 0 on success, -E_INVAL if a range is past the end of its file or the ranges
+//  overlap in the same file, or another error from the block functions.
+int file_copy(struct File *src, u_int soff, struct File *dst, u_int doff, u_int len) {
+	void *sblk, *dblk;
+	u_int diskbno, n;
+	int r;
+
+	if (soff + len < soff || soff + len > src->f_size || doff + len < doff ||
+	    doff + len > dst->f_size) {
+		return -E_INVAL;
+	}
+	if (src == dst && soff < doff + len && doff < soff + len) {
+		return -E_INVAL;
+	}
+
+	while (len > 0) {
+		n = MIN(len, BLOCK_SIZE - MAX(soff % BLOCK_SIZE, doff % BLOCK_SIZE));
+		try(file_get_block(dst, doff / BLOCK_SIZE, &dblk));
+		dblk += doff % BLOCK_SIZE;
+
+		if (src->f_flags & FILE_INLINE) {
+			memcpy(dblk, src->f_data + soff, n);
+		} else if ((r = file_map_block(src, soff / BLOCK_SIZE, &diskbno, 0)) == -E_NOT_FOUND) {
+			memset(dblk, 0, n);
+		} else if (r < 0) {
+			return r;
+		} else {
+			try(read_block(diskbno, &sblk, 0));
+			memcpy(dblk, sblk + soff % BLOCK_SIZE, n);
+		}
+		try(file_dirty(dst, doff));
+
+		soff += n;
+		doff += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// Directory lookup cache.
+//
+// 'walk_path' looks up every path component with 'dir_lookup', which would otherwise scan
+// the directory block by block. The cache is direct-mapped: the slot of a (directory, name)
+// pair holds the 'File' that the last lookup, or 'file_create', found for it. A 'File' is
+// named by its address under DISKMAP, which stays the same while its block comes and goes
+// from the block cache, so a hit only has to map the block back in and check the name.
+//
+// Entries are dropped by 'file_remove'. Truncating a directory frees blocks holding 'File's,
+// maybe those of its subdirectories' entries too, so it empties the whole cache; that only
+// happens when a directory is removed.
+struct DirCacheEntry {
+	struct File *dc_dir;
+	struct File *dc_file;
+};
+
+static struct DirCacheEntry dcache[DCACHE_NSLOTS] FS_SHARED;
+
+static struct DirCacheEntry *dcache_slot(struct File *dir, const char *name) {
+	u_int h = (u_int)dir;
+
+	while (*name) {
+		h = h * 31 + *name++;
+	}
+	return &dcache[h % DCACHE_NSLOTS];
+}
+
+static struct File *dcache_lookup(struct File *dir, const char *name) {
+	struct DirCacheEntry *e = dcache_slot(dir, name);
+	struct File *f = e->dc_file;
+
+	if (f == NULL || e->dc_dir != dir) {
+		return NULL;
+	}
+	if (read_block(disk_blockno(f), 0, 0) < 0 || strcmp(f->f_name, name) != 0) {
+		e->dc_file = NULL;
+		return NULL;
+	}
+	return f;
+}
+
+static void dcache_insert(struct File *dir, struct File *f) {
+	struct DirCacheEntry *e = dcache_slot(dir, f->f_name);
+
+	e->dc_dir = dir;
+	e->dc_file = f;
+}
+
+static void dcache_remove(struct File *dir, struct File *f) {
+	struct DirCacheEntry *e = dcache_slot(dir, f->f_name);
+
+	if (e->dc_file == f) {
+		e->dc_file = NULL;
+	}
+}
+
+static void dcache_clear(void) {
+	memset(dcache, 0, sizeof(dcache));
 }
 
 // Overview:
@@ -491,6 +1443,14 @@ int file_dirty(struct File *f, u_int offset) {
 //  Return 0 on success, and set the pointer to the target file in `*file`.
 //  Return the underlying error if an error occurs.
 int dir_lookup(struct File *dir, char *name, struct File **file) {
+	struct File *cached;
+
+	if ((cached = dcache_lookup(dir, name)) != NULL) {
+		*file = cached;
+		cached->f_dir = dir;
+		return 0;
+	}
+
 	// Step 1: Calculate the number of blocks in 'dir' via its size.
 	u_int nblock;
 	/* Exercise 5.8: Your code here. (1/3) */
@@ -515,6 +1475,7 @@ int dir_lookup(struct File *dir, char *name, struct File **file) {
 			if (strcmp(f->f_name, name) == 0) {
 				*file = f;
 				f->f_dir = dir;
+				dcache_insert(dir, f);
 				return 0;
 			}
 		}
@@ -553,6 +1514,7 @@ int dir_alloc_file(struct File *dir, struct File **file) {
 	// no free File structure in exists data block.
 	// new data block need to be created.
 	dir->f_size += BLOCK_SIZE;
+	dirty_addr(dir, dir->f_dir);
 	if ((r = file_get_block(dir, i, &blk)) < 0) {
 		return r;
 	}
@@ -676,10 +1638,38 @@ int file_create(char *path, struct File **file) {
 	}
 
 	strcpy(f->f_name, name);
+	dirty_addr(f, dir);
+	dcache_insert(dir, f);
 	*file = f;
 	return 0;
 }
 
+// Overview:
+//  Free the indirect blocks of the tree rooted at 'pbno' that no longer map any of the first
+//  'keep' file blocks of the tree. Each entry of the root block covers 'span' file blocks,
+//  and 'owner' is the file whose metadata block holds 'pbno'. The data blocks must have been
+//  cleared already.
+static void free_indirect(uint32_t *pbno, u_int span, u_int keep, struct File *owner,
+			  struct File *f) {
+	uint32_t *blk;
+
+	if (*pbno == 0) {
+		return;
+	}
+	if (span > 1) {
+		panic_on(read_block(*pbno, (void **)&blk, 0));
+		for (u_int i = keep / span; i < NINDIRECT; i++) {
+			free_indirect(&blk[i], span / NINDIRECT, keep > i * span ? keep - i * span : 0,
+				      f, f);
+		}
+	}
+	if (keep == 0) {
+		free_block(*pbno);
+		*pbno = 0;
+		dirty_addr(pbno, owner);
+	}
+}
+
 // Overview:
 //  Truncate file down to newsize bytes.
 //
@@ -688,8 +1678,10 @@ int file_create(char *path, struct File **file) {
 //  figure out the number of blocks required, and then clear the blocks from
 //  new_nblocks to old_nblocks.
 //
-//  If the new_nblocks is no more than NDIRECT, free the indirect block too.
-//  (Remember to clear the f->f_indirect pointer so you'll know whether it's valid!)
+//  Then free the indirect blocks that only pointed at the cleared blocks, down to the
+//  'f_indirect' block itself once new_nblocks is no more than NDIRECT.
+//  (Remember to clear the pointers so you'll know whether they're valid!)
+//  Extent-mapped files trim their extents instead, and inline files just clear their tail.
 //
 // Hint: use file_clear_block.
 void file_truncate(struct File *f, u_int newsize) {
@@ -698,86 +1690,94 @@ void file_truncate(struct File *f, u_int newsize) {
 	old_nblocks = ROUND(f->f_size, BLOCK_SIZE) / BLOCK_SIZE;
 	new_nblocks = ROUND(newsize, BLOCK_SIZE) / BLOCK_SIZE;
 
+	if (f->f_type == FTYPE_DIR && new_nblocks < old_nblocks) {
+		dcache_clear();
+	}
+
 	if (newsize == 0) {
 		new_nblocks = 0;
 	}
 
-	if (new_nblocks <= NDIRECT) {
-		for (bno = new_nblocks; bno < old_nblocks; bno++) {
-			panic_on(file_clear_block(f, bno));
-		}
-		if (f->f_indirect) {
-			free_block(f->f_indirect);
-			f->f_indirect = 0;
-		}
+	if (f->f_flags & FILE_INLINE) {
+		// Keep the bytes past the end zero, as they would be in a block.
+		memset(f->f_data + newsize, 0, f->f_size - newsize);
+	} else if (f->f_flags & FILE_EXTENTS) {
+		file_extent_truncate(f, new_nblocks);
 	} else {
 		for (bno = new_nblocks; bno < old_nblocks; bno++) {
 			panic_on(file_clear_block(f, bno));
 		}
+		free_indirect(&f->f_indirect, 1, new_nblocks > NDIRECT ? new_nblocks : 0, f->f_dir,
+			      f);
+		free_indirect(&f->f_indirect2, NINDIRECT, MAX(new_nblocks, NINDIRECT) - NINDIRECT,
+			      f->f_dir, f);
+		free_indirect(&f->f_indirect3, NINDIRECT2,
+			      MAX(new_nblocks, NINDIRECT + NINDIRECT2) - NINDIRECT - NINDIRECT2,
+			      f->f_dir, f);
 	}
 	f->f_size = newsize;
+	dirty_addr(f, f->f_dir);
 }
 
 // Overview:
 //  Set file size to newsize.
 int file_set_size(struct File *f, u_int newsize) {
+	int r;
+
+	if (newsize > FILE_INLINE_MAX && (r = file_spill(f)) < 0) {
+		return r;
+	}
 	if (f->f_size > newsize) {
 		file_truncate(f, newsize);
 	}
 
 	f->f_size = newsize;
-
-	if (f->f_dir) {
-		file_flush(f->f_dir);
-	}
-
+	dirty_addr(f, f->f_dir);
 	return 0;
 }
 
 // Overview:
-//  Flush the contents of file f out to disk.
-//  Loop over all the blocks in file.
-//  Translate the file block number into a disk block number and then
-//  check whether that disk block is dirty. If so, write it out.
-//
-// Hint: use file_map_block, block_is_dirty, and write_block.
+//  Flush the contents of file f out to disk: its dirty data and indirect blocks, and the
+//  blocks holding the 'File's of its entries if it is a directory.
 void file_flush(struct File *f) {
-	u_int nblocks;
-	u_int bno;
-	u_int diskno;
-	int r;
-
-	nblocks = ROUND(f->f_size, BLOCK_SIZE) / BLOCK_SIZE;
+	flush_dirty(0, f);
+}
 
-	for (bno = 0; bno < nblocks; bno++) {
-		if ((r = file_map_block(f, bno, &diskno, 0)) < 0) {
-			continue;
-		}
-		if (block_is_dirty(diskno)) {
-			write_block(diskno);
-		}
+// Overview:
+//  Make file f durable: flush it, its entry in its directory, and the blocks that belong
+//  to no file (the bitmap among them).
+void file_sync(struct File *f) {
+	file_flush(f);
+	if (f->f_dir) {
+		file_flush(f->f_dir);
 	}
+	flush_dirty(0, NULL);
 }
 
 // Overview:
-//  Sync the entire file system.  A big hammer.
+//  Sync the entire file system.  A big hammer, but only as big as the dirty set.
 void fs_sync(void) {
-	int i;
-	for (i = 0; i < super->s_nblocks; i++) {
-		if (block_is_dirty(i)) {
-			write_block(i);
-		}
+	flush_dirty(1, NULL);
+}
+
+// Overview:
+//  Delayed write-back, called by the server between requests and by the flusher. Sync the
+//  file system once the oldest dirty block has waited FLUSH_AGE cycles, or once FLUSH_NDIRTY
+//  blocks are dirty, so that writes are batched into long sorted runs. The sync sweeps the
+//  blocks of no file (the bitmap) along with the others, so every dirty block is written
+//  within FLUSH_AGE + FLUSH_INTERVAL cycles, whoever owns it.
+void fs_writeback(void) {
+	if (bcache_ndirty == 0) {
+		return;
+	}
+	if (bcache_ndirty >= FLUSH_NDIRTY || uinfo->ei_clock - bcache_dirty_since >= FLUSH_AGE) {
+		fs_sync();
 	}
 }
 
 // Overview:
-//  Close a file.
+//  Close a file. Its dirty blocks are left to 'fs_writeback'.
 void file_close(struct File *f) {
-	// Flush the file itself, if f's f_dir is set, flush it's f_dir.
-	file_flush(f);
-	if (f->f_dir) {
-		file_flush(f->f_dir);
-	}
 }
 
 // Overview:
@@ -795,17 +1795,21 @@ int file_remove(char *path) {
 	file_truncate(f, 0);
 
 	// Step 3: clear it's name.
+	dcache_remove(f->f_dir, f);
 	f->f_name[0] = '\0';
+	dirty_addr(f, f->f_dir);
 
-	// Step 4: flush the file.
-	file_flush(f);
-	if (f->f_dir) {
-		file_flush(f->f_dir);
-	}
-
+	// Step 4: the changes are written back later by 'fs_writeback'.
 	return 0;
 }
 
+// Overview:
+//  Set the type of the file 'f' just created. Its entry is written back with its directory.
+void file_set_type(struct File *f, u_int type) {
+	f->f_type = type;
+	dirty_addr(f, f->f_dir);
+}
+
 int file_get_type(struct File *f) {
 	if (f->f_type == FTYPE_REG) {
 		return -2237;
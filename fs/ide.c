@@ -7,6 +7,13 @@
 #include <malta.h>
 #include <mmu.h>
 
+/* Largest transfer issued as one command. The NSECT register is 8 bits wide. */
+#define IDE_MAX_NSECT 128
+
+/* Held by the server env issuing a command, since a worker reads the disk without holding
+ * the file system lock. */
+static fs_lock_t ide_lock FS_SHARED;
+
 /* Overview:
  *   Wait for the IDE device to complete previous requests and be ready
  *   to receive subsequent requests.
@@ -24,9 +31,10 @@ static uint8_t wait_ide_ready() {
 }
 
 /* Overview:
- *  read data from IDE disk. First issue a read request through
- *  disk register and then copy data from disk buffer
- *  (512 bytes, a sector) to destination array.
+ *  read data from IDE disk. First issue a read request for up to
+ *  IDE_MAX_NSECT sectors through disk register and then copy data
+ *  from disk buffer (512 bytes, a sector) to destination array,
+ *  one sector at a time.
  *
  * Parameters:
  *  diskno: disk number.
@@ -42,14 +50,16 @@ static uint8_t wait_ide_ready() {
  */
 void ide_read(u_int diskno, u_int secno, void *dst, u_int nsecs) {
 	uint8_t temp;
-	u_int offset = 0, max = nsecs + secno;
+	u_int offset = 0, max = nsecs + secno, n;
 	panic_on(diskno >= 2);
 
-	// Read the sector in turn
+	// Read the sectors in runs of at most IDE_MAX_NSECT
 	while (secno < max) {
+		n = MIN(max - secno, (u_int)IDE_MAX_NSECT);
+		fs_lock(&ide_lock);
 		temp = wait_ide_ready();
 		// Step 1: Write the number of operating sectors to NSECT register
-		temp = 1;
+		temp = n;
 		panic_on(syscall_write_dev(&temp, MALTA_IDE_NSECT, 1));
 
 		// Step 2: Write the 7:0 bits of sector number to LBAL register
@@ -73,24 +83,27 @@ void ide_read(u_int diskno, u_int secno, void *dst, u_int nsecs) {
 		temp = MALTA_IDE_CMD_PIO_READ;
 		panic_on(syscall_write_dev(&temp, MALTA_IDE_STATUS, 1));
 
-		// Step 7: Wait until the IDE is ready
-		temp = wait_ide_ready();
+		for (u_int sect = 0; sect < n; sect++) {
+			// Step 7: Wait until the IDE is ready
+			temp = wait_ide_ready();
 
-		// Step 8: Read the data from device
-		for (int i = 0; i < SECT_SIZE / 4; i++) {
-			panic_on(syscall_read_dev(dst + offset + i * 4, MALTA_IDE_DATA, 4));
+			// Step 8: Read the data from device
+			for (int i = 0; i < SECT_SIZE / 4; i++) {
+				panic_on(syscall_read_dev(dst + offset + i * 4, MALTA_IDE_DATA, 4));
+			}
+			offset += SECT_SIZE;
 		}
 
 		// Step 9: Check IDE status
 		panic_on(syscall_read_dev(&temp, MALTA_IDE_STATUS, 1));
+		fs_unlock(&ide_lock);
 
-		offset += SECT_SIZE;
-		secno += 1;
+		secno += n;
 	}
 }
 
 /* Overview:
- *  write data to IDE disk.
+ *  write data to IDE disk, up to IDE_MAX_NSECT sectors per request.
  *
  * Parameters:
  *  diskno: disk number.
@@ -106,15 +119,17 @@ void ide_read(u_int diskno, u_int secno, void *dst, u_int nsecs) {
  */
 void ide_write(u_int diskno, u_int secno, void *src, u_int nsecs) {
 	uint8_t temp;
-	u_int offset = 0, max = nsecs + secno;
+	u_int offset = 0, max = nsecs + secno, n;
 	panic_on(diskno >= 2);
 
-	// Write the sector in turn
+	// Write the sectors in runs of at most IDE_MAX_NSECT
 	while (secno < max) {
+		n = MIN(max - secno, (u_int)IDE_MAX_NSECT);
+		fs_lock(&ide_lock);
 		temp = wait_ide_ready();
 		// Step 1: Write the number of operating sectors to NSECT register
 		/* Exercise 5.3: Your code here. (3/9) */
-		temp = 1;
+		temp = n;
 		panic_on(syscall_write_dev(&temp, MALTA_IDE_NSECT, 1));
 		// Step 2: Write the 7:0 bits of sector number to LBAL register
 		/* Exercise 5.3: Your code here. (4/9) */
@@ -140,20 +155,23 @@ void ide_write(u_int diskno, u_int secno, void *src, u_int nsecs) {
 		temp = MALTA_IDE_CMD_PIO_WRITE;
 		panic_on(syscall_write_dev(&temp, MALTA_IDE_STATUS, 1));
 
-		// Step 7: Wait until the IDE is ready
-		temp = wait_ide_ready();
+		for (u_int sect = 0; sect < n; sect++) {
+			// Step 7: Wait until the IDE is ready
+			temp = wait_ide_ready();
 
-		// Step 8: Write the data to device
-		for (int i = 0; i < SECT_SIZE / 4; i++) {
-			/* Exercise 5.3: Your code here. (9/9) */
-			panic_on(syscall_write_dev(src + offset + i * 4, MALTA_IDE_DATA, 4));
+			// Step 8: Write the data to device
+			for (int i = 0; i < SECT_SIZE / 4; i++) {
+				/* Exercise 5.3: Your code here. (9/9) */
+				panic_on(syscall_write_dev(src + offset + i * 4, MALTA_IDE_DATA, 4));
+			}
+			offset += SECT_SIZE;
 		}
 
 		// Step 9: Check IDE status
 		panic_on(syscall_read_dev(&temp, MALTA_IDE_STATUS, 1));
+		fs_unlock(&ide_lock);
 
-		offset += SECT_SIZE;
-		secno += 1;
+		secno += n;
 	}
 }
 
@@ -20,8 +20,21 @@ struct Open {
 	u_int o_fileid;
 	int o_mode;
 	struct Filefd *o_ff;
+	u_int o_pin[2]; // cache blocks pinned for 'o_file' and its 'f_dir'
+	u_int o_npin;
+	u_int o_ra_next;   // file block the client will map next if it reads sequentially
+	u_int o_ra_window; // number of blocks read ahead, 0 after a non-sequential map
+	u_int o_ra_end;	   // first file block not read ahead yet
+	u_int o_written;   // the file was written or spilled through this open
 };
 
+/*
+ * Read-ahead window, in blocks. It starts at RA_MIN on the first sequential map and
+ * doubles on each following one, up to RA_MAX.
+ */
+#define RA_MIN 4
+#define RA_MAX 32
+
 /*
  * Max number of open files in the file system at once
  */
@@ -30,15 +43,108 @@ struct Open {
 #define FILEVA 0x60000000
 
 /*
- * Open file table, a per-environment array of open files
+ * Open file table, a per-environment array of open files, shared by the server envs
+ */
+struct Open opentab[MAXOPEN] FS_SHARED;
+
+/*
+ * Locks of the files being served, by hash of their 'File'. A request naming a path takes
+ * 'path_lock' instead, which orders the changes to directories, then the lock of the file
+ * it truncates or removes, once it has found it. The locks are held while their holder
+ * waits for the disk, so a request that misses the cache only holds up the requests on the
+ * same files (or, for a path, the other path requests).
+ */
+#define NFILELOCK 16
+
+static fs_lock_t file_locks[NFILELOCK] FS_SHARED;
+static fs_lock_t path_lock FS_SHARED;
+
+static u_int file_lockno(struct File *f) {
+	return (u_int)f / FILE_STRUCT_SIZE % NFILELOCK;
+}
+
+/*
+ * Overview:
+ *  Take the locks 'locks[lo]' to 'locks[hi - 1]', holding the file system lock. Their
+ *  holder may be waiting for the disk without it, so give it up while we wait.
  */
-struct Open opentab[MAXOPEN];
+static void lock_range(fs_lock_t *locks, u_int lo, u_int hi) {
+	u_int i;
+
+	for (;;) {
+		for (i = lo; i < hi && fs_trylock(&locks[i]); i++) {
+		}
+		if (i == hi) {
+			return;
+		}
+		while (i-- > lo) {
+			fs_unlock(&locks[i]);
+		}
+		fs_leave();
+		syscall_yield();
+		fs_enter();
+	}
+}
+
+/*
+ * Overview:
+ *  Lock 'f', found by a request naming a path, before changing it.
+ */
+static void file_lock(struct File *f) {
+	lock_range(file_locks, file_lockno(f), file_lockno(f) + 1);
+}
+
+static void file_unlock(struct File *f) {
+	fs_unlock(&file_locks[file_lockno(f)]);
+}
 
 /*
  * Virtual address at which to receive page mappings containing client requests.
  */
 #define REQVA 0x0ffff000
 
+/*
+ * Request page of the write-back flusher, which asks for FSREQ_FLUSH every FLUSH_INTERVAL cycles.
+ */
+#define FLUSHVA (REQVA - BLOCK_SIZE)
+#define FLUSH_INTERVAL (FLUSH_AGE / 2)
+
+/*
+ * Rings of the clients (see 'struct Fsring'), mapped in all the server envs. Only the
+ * dispatcher looks at their submission queues.
+ */
+#define MAXRING 256
+#define RINGVA (FILEVA + MAXOPEN * BLOCK_SIZE)
+#define RING(i) ((struct Fsring *)(RINGVA + (i) * BLOCK_SIZE))
+
+static u_int ringenv[MAXRING]; // client of each ring
+static u_int nring;	       // rings ever set up
+static u_int ring_next;	       // where to look for a request first
+
+/*
+ * Named pipes (FTYPE_FIFO) that have been opened. Their data never goes to the disk: the
+ * ends share a page holding the pipe, which the kernel keeps parked under 'fi_key' for the
+ * next clients (see 'sys_page_park'). A named pipe is known by the address of its 'File' in
+ * the block cache. Each server env maps the page at FIFOVA while it looks at it.
+ */
+#define MAXFIFO 32
+#define FIFOVA (RINGVA + MAXRING * BLOCK_SIZE)
+
+struct Fifo {
+	u_int fi_key;	      // word the page is parked under
+	struct File *fi_file; // NULL if the entry is free
+};
+
+static struct Fifo fifotab[MAXFIFO] FS_SHARED;
+
+/*
+ * The ring request being served by this worker, if any, and whether its client must be
+ * woken up once it is done.
+ */
+static struct Fsring *serve_ring;
+static u_int serve_slot;
+static int serve_wake;
+
 /*
  * Overview:
  *  Set up open file table and connect it with the file cache.
@@ -58,6 +164,31 @@ void serve_init(void) {
 	}
 }
 
+/*
+ * Overview:
+ *  Pin the cache blocks holding 'f' and its directory entry while 'o' is open,
+ *  since 'o_file' and 'f->f_dir' point into them.
+ *  A Filefd may be shared by several envs which each close it, so the blocks are
+ *  only unpinned when 'open_alloc' finds the entry unreferenced and reuses it.
+ */
+static void open_pin(struct Open *o, struct File *f) {
+	o->o_npin = 0;
+	o->o_pin[o->o_npin++] = disk_blockno(f);
+	if (f->f_dir) {
+		o->o_pin[o->o_npin++] = disk_blockno(f->f_dir);
+	}
+	for (u_int i = 0; i < o->o_npin; i++) {
+		block_pin(o->o_pin[i]);
+	}
+}
+
+static void open_unpin(struct Open *o) {
+	for (u_int i = 0; i < o->o_npin; i++) {
+		block_unpin(o->o_pin[i]);
+	}
+	o->o_npin = 0;
+}
+
 /*
  * Overview:
  *  Allocate an open file.
@@ -71,16 +202,17 @@ int open_alloc(struct Open **o) {
 
 	// Find an available open-file table entry
 	for (i = 0; i < MAXOPEN; i++) {
-		switch (pageref(opentab[i].o_ff)) {
-		case 0:
-			if ((r = syscall_mem_alloc(0, opentab[i].o_ff, PTE_D | PTE_LIBRARY)) < 0) {
-				return r;
-			}
-		case 1:
-			*o = &opentab[i];
-			memset((void *)opentab[i].o_ff, 0, BLOCK_SIZE);
-			return (*o)->o_fileid;
+		r = pageref(opentab[i].o_ff);
+		if (r == 0) {
+			try(fs_page_alloc(opentab[i].o_ff));
+		} else if (r != fs_nref()) {
+			continue;
 		}
+		// No client refers to this entry any more.
+		open_unpin(&opentab[i]);
+		*o = &opentab[i];
+		memset((void *)opentab[i].o_ff, 0, BLOCK_SIZE);
+		return (*o)->o_fileid;
 	}
 
 	return -E_MAX_OPEN;
@@ -109,13 +241,92 @@ int open_lookup(u_int envid, u_int fileid, struct Open **po) {
 
 	o = &opentab[fileid];
 
-	if (pageref(o->o_ff) <= 1) {
+	if (pageref(o->o_ff) <= fs_nref()) {
 		return -E_INVAL;
 	}
 
 	*po = o;
 	return 0;
 }
+/*
+ * Overview:
+ *  Count the open files of 'f' that some client still refers to.
+ */
+static u_int open_count(struct File *f) {
+	u_int n = 0;
+
+	for (int i = 0; i < MAXOPEN; i++) {
+		if (opentab[i].o_file == f && pageref(opentab[i].o_ff) > fs_nref()) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * Overview:
+ *  Move the data of the inline file of 'o' out to a block before the file is mapped or grows.
+ *  The clients read the copy of the data in their Filefd until then, so clear the flag there
+ *  too: they map the file like any other from now on.
+ */
+static int open_spill(struct Open *o) {
+	struct File *f = o->o_file;
+	int r;
+
+	if (!(f->f_flags & FILE_INLINE)) {
+		return 0;
+	}
+	if ((r = file_spill(f)) < 0) {
+		return r;
+	}
+	o->o_written = 1;
+	for (int i = 0; i < MAXOPEN; i++) {
+		if (opentab[i].o_file == f && pageref(opentab[i].o_ff) > fs_nref()) {
+			opentab[i].o_ff->f_file.f_flags &= ~FILE_INLINE;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Overview:
+ *  Reply 'r' to the request of 'envid' at REQVA, with the pages at 'srcvas'. A tagged
+ *  request gets 'r' in its trailer and its tag as the IPC value (see 'struct Fsreq_tag').
+ */
+static void serve_reply_pages(u_int envid, int r, void *const *srcvas, u_int npages, u_int perm) {
+	struct Fsreq_tag *t = FSREQ_TAG(REQVA);
+
+	if (t->req_tag) {
+		t->req_result = r;
+		r = t->req_tag;
+	}
+	ipc_send_pages(envid, r, srcvas, npages, perm);
+}
+
+static void serve_reply(u_int envid, int r, void *srcva, u_int perm) {
+	struct Fsreq_tag *t = FSREQ_TAG(REQVA);
+	struct Fsring_cqe *c;
+
+	// A request from the ring completes in the ring. The requests allowed there send no
+	// pages. The big lock orders the completions of a ring.
+	if (serve_ring) {
+		c = &serve_ring->r_cq[serve_ring->r_cq_tail % FSIPC_NSLOT];
+		c->cqe_tag = serve_ring->r_sqe[serve_slot].sqe_tag;
+		c->cqe_result = r;
+		__sync_synchronize();
+		serve_ring->r_cq_tail++;
+		__sync_synchronize();
+		serve_wake = __sync_bool_compare_and_swap(&serve_ring->r_cwait, 1, 0);
+		return;
+	}
+
+	if (t->req_tag) {
+		t->req_result = r;
+		r = t->req_tag;
+	}
+	ipc_send(envid, r, srcva, perm);
+}
+
 /*
  * Functions with the prefix "serve_" are those who
  * conduct the file system requests from clients.
@@ -148,28 +359,36 @@ void serve_open(u_int envid, struct Fsreq_open *rq) {
 
 	// Find a file id.
 	if ((r = open_alloc(&o)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
 	if ((rq->req_omode & O_CREAT) && (r = file_create(rq->req_path, &f)) < 0 &&
 	    r != -E_FILE_EXISTS) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
-	// Open the file.
+	// Open the file. Other requests on it may be waiting for the disk in the middle of
+	// changing it: lock it to get a consistent copy of its 'File'.
 	if ((r = file_open(rq->req_path, &f)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
+	file_lock(f);
 
 	// Save the file pointer.
 	o->o_file = f;
+	open_pin(o, f);
+	o->o_ra_next = 0;
+	o->o_ra_window = 0;
+	o->o_ra_end = 0;
+	o->o_written = (rq->req_omode & O_TRUNC) != 0;
 
 	if (rq->req_omode & O_GETTYPE) {
 		if ((r = (file_get_type(f))) < 0) {
-			ipc_send(envid, r, 0, 0);
+			serve_reply(envid, r, 0, 0);
+			file_unlock(f);
 			return;
 		}
 	}
@@ -177,7 +396,7 @@ void serve_open(u_int envid, struct Fsreq_open *rq) {
 	// If mode include O_TRUNC, set the file size to 0
 	if (rq->req_omode & O_TRUNC) {
 		if ((r = file_set_size(f, 0)) < 0) {
-			ipc_send(envid, r, 0, 0);
+			serve_reply(envid, r, 0, 0);
 		}
 	}
 
@@ -188,7 +407,35 @@ void serve_open(u_int envid, struct Fsreq_open *rq) {
 	o->o_mode = rq->req_omode;
 	ff->f_fd.fd_omode = o->o_mode;
 	ff->f_fd.fd_dev_id = devfile.dev_id;
-	ipc_send(envid, 0, o->o_ff, PTE_D | PTE_LIBRARY);
+	serve_reply(envid, 0, o->o_ff, PTE_D | PTE_LIBRARY);
+	file_unlock(f);
+}
+
+/*
+ * Overview:
+ *  Read ahead after the client of 'o' has been sent the 'n' blocks starting at 'filebno'.
+ *  The reply has been sent, so the client runs while we wait for the disk.
+ */
+static void open_readahead(struct Open *o, u_int filebno, u_int n) {
+	u_int last = filebno + n - 1;
+
+	// Sequential access detection: grow the window while the client keeps asking for the
+	// blocks after the previous ones, and stop reading ahead as soon as it doesn't.
+	if (filebno == o->o_ra_next) {
+		o->o_ra_window = o->o_ra_window ? MIN(2 * o->o_ra_window, RA_MAX) : RA_MIN;
+		o->o_ra_window = MAX(o->o_ra_window, n);
+	} else {
+		o->o_ra_window = 0;
+		o->o_ra_end = 0;
+	}
+	o->o_ra_next = last + 1;
+
+	// Read the next window once the client is half way through the blocks already read ahead.
+	if (o->o_ra_window && last + o->o_ra_window / 2 >= o->o_ra_end) {
+		u_int start = MAX(last + 1, o->o_ra_end);
+		file_prefetch(o->o_file, start, o->o_ra_window);
+		o->o_ra_end = start + o->o_ra_window;
+	}
 }
 
 /*
@@ -211,18 +458,64 @@ void serve_map(u_int envid, struct Fsreq_map *rq) {
 	int r;
 
 	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
 	filebno = rq->req_offset / BLOCK_SIZE;
 
-	if ((r = file_get_block(pOpen->o_file, filebno, &blk)) < 0) {
-		ipc_send(envid, r, 0, 0);
+	if ((r = open_spill(pOpen)) < 0 || (r = file_get_block(pOpen->o_file, filebno, &blk)) < 0) {
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
-	ipc_send(envid, 0, blk, PTE_D | PTE_LIBRARY);
+	serve_reply(envid, 0, blk, PTE_WTRACK | PTE_LIBRARY);
+	open_readahead(pOpen, filebno, 1);
+}
+
+/*
+ * Overview:
+ *  Serve to map a range of consecutive blocks of a file, so that a client faulting in
+ *  the pages of a file needs one IPC per IPC_MAXPAGES blocks instead of one per block.
+ * Parameters:
+ *  envid: the id of the request process.
+ *  rq: the request, which contains the fileid, the offset and the number of blocks.
+ * Return:
+ *  if Success, use ipc_send_pages to return zero and the blocks to the caller.
+ *  Otherwise, return the error value to the caller.
+ */
+void serve_map_range(u_int envid, struct Fsreq_map_range *rq) {
+	struct Open *pOpen;
+	void *blks[IPC_MAXPAGES];
+	u_int filebno, n;
+	int r;
+
+	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+
+	n = rq->req_npages;
+	if (n == 0 || n > IPC_MAXPAGES) {
+		serve_reply(envid, -E_INVAL, 0, 0);
+		return;
+	}
+
+	if ((r = open_spill(pOpen)) < 0) {
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+
+	filebno = rq->req_offset / BLOCK_SIZE;
+	for (u_int i = 0; i < n; i++) {
+		if ((r = file_get_block(pOpen->o_file, filebno + i, &blks[i])) < 0) {
+			serve_reply(envid, r, 0, 0);
+			return;
+		}
+	}
+
+	serve_reply_pages(envid, 0, blks, n, PTE_WTRACK | PTE_LIBRARY);
+	open_readahead(pOpen, filebno, n);
 }
 
 /*
@@ -241,16 +534,22 @@ void serve_set_size(u_int envid, struct Fsreq_set_size *rq) {
 	struct Open *pOpen;
 	int r;
 	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+
+	if (rq->req_size > FILE_INLINE_MAX && (r = open_spill(pOpen)) < 0) {
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
+	pOpen->o_written = 1;
 
 	if ((r = file_set_size(pOpen->o_file, rq->req_size)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
-	ipc_send(envid, 0, 0, 0);
+	serve_reply(envid, 0, 0, 0);
 }
 
 /*
@@ -271,12 +570,20 @@ void serve_close(u_int envid, struct Fsreq_close *rq) {
 	int r;
 
 	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
 	file_close(pOpen->o_file);
-	ipc_send(envid, 0, 0, 0);
+
+	// Once its last client is gone, a small file written through this open goes back into its
+	// 'File'. Its dirty pages have been reported before the close. A file only read is left
+	// as it is, rather than having its blocks freed and its 'File' rewritten for nothing.
+	if (pOpen->o_written && pageref(pOpen->o_ff) == fs_nref() + 1 &&
+	    open_count(pOpen->o_file) == 1) {
+		file_inline(pOpen->o_file);
+	}
+	serve_reply(envid, 0, 0, 0);
 }
 
 /*
@@ -292,12 +599,18 @@ void serve_close(u_int envid, struct Fsreq_close *rq) {
  */
 void serve_remove(u_int envid, struct Fsreq_remove *rq) {
 	// Step 1: Remove the file specified in 'rq' using 'file_remove' and store its return value.
+	struct File *f;
 	int r;
 	/* Exercise 5.11: Your code here. (1/2) */
-	r = file_remove(rq->req_path);
+	// Requests on the file may be waiting for the disk: wait for them before it goes.
+	if ((r = file_open(rq->req_path, &f)) == 0) {
+		file_lock(f);
+		r = file_remove(rq->req_path);
+		file_unlock(f);
+	}
 	// Step 2: Respond the return value to the caller 'envid' using 'ipc_send'.
 	/* Exercise 5.11: Your code here. (2/2) */
-	ipc_send(envid, r, 0, 0);
+	serve_reply(envid, r, 0, 0);
 }
 
 /*
@@ -317,16 +630,162 @@ void serve_dirty(u_int envid, struct Fsreq_dirty *rq) {
 	int r;
 
 	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
+	pOpen->o_written = 1;
 	if ((r = file_dirty(pOpen->o_file, rq->req_offset)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+
+	serve_reply(envid, 0, 0, 0);
+}
+
+/*
+ * Overview:
+ *  Serve to mark the pages in the ranges of `rq` dirty, so that a client closing a file
+ *  tells us about all the pages it has written with a single request.
+ */
+void serve_dirty_range(u_int envid, struct Fsreq_dirty_range *rq) {
+	struct Open *pOpen;
+	struct Fsreq_range *range;
+	int r;
+
+	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+
+	if (rq->req_nrange > FSREQ_MAXRANGE) {
+		serve_reply(envid, -E_INVAL, 0, 0);
+		return;
+	}
+
+	pOpen->o_written = 1;
+	for (u_int i = 0; i < rq->req_nrange; i++) {
+		range = &rq->req_range[i];
+		for (u_int j = 0; j < range->npages; j++) {
+			if ((r = file_dirty(pOpen->o_file, range->offset + j * BLOCK_SIZE)) < 0) {
+				serve_reply(envid, r, 0, 0);
+				return;
+			}
+		}
+	}
+
+	serve_reply(envid, 0, 0, 0);
+}
+
+/*
+ * Overview:
+ *  Serve to copy a range of an open file to another (or to the same one) inside the server,
+ *  so that the data never goes through the client.
+ */
+void serve_copy(u_int envid, struct Fsreq_copy *rq) {
+	struct Open *src, *dst;
+	int r;
+
+	if ((r = open_lookup(envid, rq->req_fileid, &dst)) < 0 ||
+	    (r = open_lookup(envid, rq->req_src_fileid, &src)) < 0 || (r = open_spill(dst)) < 0) {
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
-	ipc_send(envid, 0, 0, 0);
+	dst->o_written = 1;
+	r = file_copy(src->o_file, rq->req_src_offset, dst->o_file, rq->req_offset, rq->req_len);
+	serve_reply(envid, r, 0, 0);
+}
+
+/*
+ * Overview:
+ *  Map the page of 'fi' at FIFOVA, and tell whether a client maps it too: besides them,
+ *  only the parking slot and FIFOVA refer to it.
+ */
+static int fifo_busy(struct Fifo *fi) {
+	if (syscall_page_unpark(&fi->fi_key, (void *)FIFOVA, PTE_D, 1) < 0) {
+		return 0;
+	}
+	return pageref((void *)FIFOVA) > 2;
+}
+
+static void fifo_free(struct Fifo *fi) {
+	syscall_mem_unmap(0, (void *)FIFOVA);
+	syscall_page_unpark(&fi->fi_key, 0, 0, 0);
+	fi->fi_file = NULL;
+}
+
+/*
+ * Overview:
+ *  Map the page of the named pipe 'f' at FIFOVA. A named pipe none of whose ends is open
+ *  any more gets a fresh page, so that the next clients don't see stale data. When the
+ *  table is full, entries of such pipes are reclaimed.
+ *
+ * Post-Condition:
+ *  Return 0 on success, -E_MAX_OPEN if all the entries are in use, or the error of the
+ *  page syscalls.
+ */
+static int fifo_map(struct File *f) {
+	struct Fifo *fi, *free = NULL;
+	int r;
+
+	for (fi = fifotab; fi < fifotab + MAXFIFO; fi++) {
+		if (fi->fi_file == f) {
+			if (fifo_busy(fi)) {
+				return 0;
+			}
+			fifo_free(fi);
+			free = fi;
+			break;
+		}
+		if (fi->fi_file == NULL && free == NULL) {
+			free = fi;
+		}
+	}
+	for (fi = fifotab; free == NULL && fi < fifotab + MAXFIFO; fi++) {
+		if (fifo_busy(fi)) {
+			syscall_mem_unmap(0, (void *)FIFOVA);
+		} else {
+			fifo_free(fi);
+			free = fi;
+		}
+	}
+	if (free == NULL) {
+		return -E_MAX_OPEN;
+	}
+
+	try(syscall_mem_alloc(0, (void *)FIFOVA, PTE_D));
+	if ((r = syscall_page_park(&free->fi_key, (void *)FIFOVA)) < 0) {
+		syscall_mem_unmap(0, (void *)FIFOVA);
+		return r;
+	}
+	free->fi_file = f;
+	return 0;
+}
+
+/*
+ * Overview:
+ *  Serve to map the page shared by the ends of an open named pipe. The data written to
+ *  the pipe only ever goes through that page (and the pages parked in it).
+ */
+void serve_fifo(u_int envid, struct Fsreq_fifo *rq) {
+	struct Open *pOpen;
+	int r;
+
+	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+	if (pOpen->o_file->f_type != FTYPE_FIFO) {
+		serve_reply(envid, -E_INVAL, 0, 0);
+		return;
+	}
+	if ((r = fifo_map(pOpen->o_file)) < 0) {
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+	serve_reply(envid, 0, (void *)FIFOVA, PTE_D | PTE_LIBRARY);
+	syscall_mem_unmap(0, (void *)FIFOVA);
 }
 
 /*
@@ -338,7 +797,7 @@ void serve_dirty(u_int envid, struct Fsreq_dirty *rq) {
  */
 void serve_sync(u_int envid) {
 	fs_sync();
-	ipc_send(envid, 0, 0, 0);
+	serve_reply(envid, 0, 0, 0);
 }
 
 void serve_create(u_int envid, struct Fsreq_create *rq) {
@@ -346,11 +805,46 @@ void serve_create(u_int envid, struct Fsreq_create *rq) {
 	char *path = rq->req_path;
 	struct File *file;
 	if((r = file_create(path, &file)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
-	file->f_type = rq->f_type;
-	ipc_send(envid, 0, 0, 0);
+	file_set_type(file, rq->f_type);
+	serve_reply(envid, 0, 0, 0);
+}
+
+/*
+ * Overview:
+ *  Serve to make one file durable. The client has already marked its pages dirty.
+ */
+void serve_fsync(u_int envid, struct Fsreq_fsync *rq) {
+	struct Open *pOpen;
+	int r;
+
+	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+
+	file_sync(pOpen->o_file);
+	serve_reply(envid, 0, 0, 0);
+}
+
+/*
+ * Overview:
+ *  Serve the periodic request of the flusher: write back dirty blocks if they are old enough.
+ */
+void serve_flush(u_int envid) {
+	fs_writeback();
+	serve_reply(envid, 0, 0, 0);
+}
+
+/*
+ * Overview:
+ *  Serve to report the block cache counters, which are stored into the request page.
+ */
+void serve_cache_stat(u_int envid, struct Fsreq_cache_stat *rq) {
+	block_cache_stat(&rq->req_stat);
+	serve_reply(envid, 0, 0, 0);
 }
 
 /*
@@ -362,24 +856,266 @@ void *serve_table[MAX_FSREQNO] = {
     [FSREQ_OPEN] = serve_open,	 [FSREQ_MAP] = serve_map,     [FSREQ_SET_SIZE] = serve_set_size,
     [FSREQ_CLOSE] = serve_close, [FSREQ_DIRTY] = serve_dirty, [FSREQ_REMOVE] = serve_remove,
     [FSREQ_SYNC] = serve_sync, [FSREQ_CREATE] = serve_create,
+    [FSREQ_CACHE_STAT] = serve_cache_stat, [FSREQ_FSYNC] = serve_fsync,
+    [FSREQ_FLUSH] = serve_flush, [FSREQ_MAP_RANGE] = serve_map_range,
+    [FSREQ_DIRTY_RANGE] = serve_dirty_range, [FSREQ_COPY] = serve_copy,
+    [FSREQ_FIFO] = serve_fifo,
 };
 
+/*
+ * Overview:
+ *  Serve request 'req' of 'whom', whose arguments are at 'rq', in a worker.
+ *  A request on an open file locks that file; one naming a path takes 'path_lock'.
+ */
+static void serve_request(u_int whom, u_int req, void *rq) {
+	void (*func)(u_int, void *);
+	u_int lo = 0, hi = 0, path = 0, fileid, src, slot;
+
+	fs_enter();
+	switch (req) {
+	case FSREQ_OPEN:
+	case FSREQ_CREATE:
+	case FSREQ_REMOVE:
+		path = 1;
+		break;
+	case FSREQ_MAP:
+	case FSREQ_MAP_RANGE:
+	case FSREQ_SET_SIZE:
+	case FSREQ_CLOSE:
+	case FSREQ_DIRTY:
+	case FSREQ_DIRTY_RANGE:
+	case FSREQ_FSYNC:
+	case FSREQ_FIFO:
+		fileid = *(u_int *)rq;
+		if (fileid < MAXOPEN) {
+			lo = file_lockno(opentab[fileid].o_file);
+			hi = lo + 1;
+		}
+		break;
+	case FSREQ_COPY:
+		// Both files: take the locks from the lower to the higher of theirs.
+		fileid = ((struct Fsreq_copy *)rq)->req_fileid;
+		src = ((struct Fsreq_copy *)rq)->req_src_fileid;
+		if (fileid < MAXOPEN && src < MAXOPEN) {
+			lo = file_lockno(opentab[fileid].o_file);
+			hi = file_lockno(opentab[src].o_file);
+			if (lo > hi) {
+				fileid = lo;
+				lo = hi;
+				hi = fileid;
+			}
+			hi++;
+		}
+		break;
+	}
+	lock_range(&path_lock, 0, path);
+	lock_range(file_locks, lo, hi);
+
+	// Select the serve function and call it.
+	slot = block_cache_begin_request();
+	func = serve_table[req];
+	func(whom, rq);
+
+	// Write back if too many blocks are dirty (or have been for too long).
+	fs_writeback();
+	block_cache_end_request(slot);
+
+	while (hi-- > lo) {
+		fs_unlock(&file_locks[hi]);
+	}
+	if (path) {
+		fs_unlock(&path_lock);
+	}
+	fs_leave();
+}
+
+/*
+ * Overview:
+ *  Wake up the client 'envid', which waits for a completion in its ring. It said it would
+ *  receive the message, unless it is gone.
+ */
+static void ring_wake(u_int envid) {
+	while (syscall_ipc_try_send(envid, FSRING_WAKE, 0, 0) == -E_IPC_NOT_RECV) {
+		syscall_yield();
+	}
+}
+
+/*
+ * Overview:
+ *  The main loop of a worker: serve the requests the dispatcher hands to 'w'.
+ */
+static void worker(struct Worker *w) {
+	u_int req, whom, perm;
+
+	worker_self = w;
+	for (;;) {
+		req = ipc_recv(&whom, (void *)REQVA, &perm);
+		if (w->w_ring) {
+			serve_ring = RING(w->w_ring - 1);
+			serve_slot = w->w_slot;
+			serve_request(w->w_whom, req, serve_ring->r_sqe[serve_slot].sqe_req);
+			serve_ring = NULL;
+			if (serve_wake) {
+				ring_wake(w->w_whom);
+				serve_wake = 0;
+			}
+		} else {
+			serve_request(w->w_whom, req, (void *)REQVA);
+
+			// Unmap the argument page.
+			panic_on(syscall_mem_unmap(0, (void *)REQVA));
+		}
+		w->w_busy = 0;
+	}
+}
+
+/*
+ * Overview:
+ *  Tell whether ring 'i' may be given to another client: its client is gone (none of its
+ *  envs maps it any more), and no worker is serving one of its requests. Such a worker would
+ *  append the completion, with the old tag, to the ring of the new client.
+ */
+static int ring_free(u_int i) {
+	if (pageref(RING(i)) > fs_nref()) {
+		return 0;
+	}
+	for (u_int j = 0; j < nworkers; j++) {
+		if (workers[j].w_busy && workers[j].w_ring == i + 1) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Overview:
+ *  Register the ring page of 'whom', received at REQVA, mapping it in all the server envs.
+ *  The ring of a client that is gone is reused once 'ring_free' says so.
+ *
+ * Return:
+ *  0 on success, -E_MAX_OPEN if all MAXRING rings are in use.
+ */
+static int ring_setup(u_int whom) {
+	u_int i;
+
+	for (i = 0; i < nring && !ring_free(i); i++) {
+	}
+	if (i == MAXRING) {
+		return -E_MAX_OPEN;
+	}
+	try(syscall_mem_map(0, (void *)REQVA, 0, RING(i), PTE_D));
+	for (u_int j = 0; j < nworkers; j++) {
+		try(syscall_mem_map(0, (void *)REQVA, workers[j].w_envid, RING(i), PTE_D));
+	}
+	ringenv[i] = whom;
+	nring = MAX(nring, i + 1);
+	return 0;
+}
+
+/*
+ * Overview:
+ *  Hand the next request queued in a ring over to worker 'w', taking the rings in turn.
+ *
+ * Return:
+ *  1 if a request was found, 0 otherwise.
+ */
+static int ring_dispatch(struct Worker *w) {
+	struct Fsring *ring;
+	u_int i, slot, type;
+
+	for (u_int n = 0; n < nring; n++) {
+		i = (ring_next + n) % nring;
+		ring = RING(i);
+		if (ring->r_sq_head == ring->r_sq_tail || pageref(ring) <= fs_nref()) {
+			continue;
+		}
+		__sync_synchronize();
+		slot = ring->r_sq[ring->r_sq_head % FSIPC_NSLOT] % FSIPC_NSLOT;
+		type = ring->r_sqe[slot].sqe_type;
+		ring->r_sq_head++;
+		ring_next = i + 1;
+
+		if (type >= MAX_FSREQNO || !(FSRING_TYPES & (1 << type))) {
+			debugf("Invalid ring request code %d from %08x\n", type, ringenv[i]);
+			continue; // just leave it hanging, like an invalid request page.
+		}
+		w->w_whom = ringenv[i];
+		w->w_ring = i + 1;
+		w->w_slot = slot;
+		w->w_busy = 1;
+		ipc_send(w->w_envid, type, 0, 0);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Overview:
+ *  Tell the clients whether the dispatcher sleeps, so that they wake it up for the requests
+ *  they queue in their rings.
+ */
+static void ring_idle(u_int idle) {
+	for (u_int i = 0; i < nring; i++) {
+		RING(i)->r_sidle = idle;
+	}
+}
+
+static int is_worker(u_int envid) {
+	for (u_int i = 0; i < nworkers; i++) {
+		if (workers[i].w_envid == envid) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /*
  * Overview:
  *  The main loop of the file system server.
  *  It receives requests from other processes, if no request,
  *  the kernel will schedule other processes. Otherwise, it will
- *  call the corresponding serve function with the reqeust number
- *  to handle the request.
+ *  hand the request to an idle worker, which calls the
+ *  corresponding serve function with the reqeust number.
+ *  A worker waiting for a page request wakes it up with an empty message.
  */
 void serve(void) {
-	u_int req, whom, perm;
-	void (*func)(u_int, u_int);
+	u_int req, whom, perm, i;
+	struct Worker *w;
 
 	for (;;) {
+		share_service();
+
+		// Wait for a worker to be idle before taking a request.
+		for (i = 0; i < nworkers && workers[i].w_busy; i++) {
+		}
+		if (i == nworkers) {
+			syscall_yield();
+			continue;
+		}
+		w = &workers[i];
+
+		// The requests in the rings come first.
+		if (ring_dispatch(w)) {
+			continue;
+		}
+
+		// None: the clients must wake us up from now on. Look again, in case one was
+		// queued before it could see that.
+		ring_idle(1);
+		if (ring_dispatch(w)) {
+			ring_idle(0);
+			continue;
+		}
+
 		perm = 0;
 
 		req = ipc_recv(&whom, (void *)REQVA, &perm);
+		ring_idle(0);
+
+		// A worker wants its page request served, or a client its ring looked at.
+		if (is_worker(whom) || req == FSREQ_KICK) {
+			continue;
+		}
 
 		// All requests must contain an argument page
 		if (!(perm & PTE_V)) {
@@ -394,15 +1130,45 @@ void serve(void) {
 			continue;
 		}
 
-		// Select the serve function and call it.
-		func = serve_table[req];
-		func(whom, REQVA);
+		// A client registers its ring.
+		if (req == FSREQ_RING) {
+			ipc_send(whom, ring_setup(whom), 0, 0);
+			panic_on(syscall_mem_unmap(0, (void *)REQVA));
+			continue;
+		}
+
+		// Hand the request over, with its argument page.
+		w->w_whom = whom;
+		w->w_ring = 0;
+		w->w_busy = 1;
+		ipc_send(w->w_envid, req, (void *)REQVA, perm);
 
 		// Unmap the argument page.
 		panic_on(syscall_mem_unmap(0, (void *)REQVA));
 	}
 }
 
+/*
+ * Overview:
+ *  The write-back flusher. The server blocks in 'ipc_recv' while idle, so this child
+ *  wakes it up every FLUSH_INTERVAL cycles to write back aged dirty blocks. In between it
+ *  sleeps in the kernel (a timed wait on no key), so it costs nothing while the system idles.
+ */
+static void flusher(u_int fsenv) {
+	uint64_t next = uinfo->ei_clock;
+	u_int whom;
+
+	panic_on(syscall_mem_alloc(0, (void *)FLUSHVA, PTE_D));
+	for (;;) {
+		next += FLUSH_INTERVAL;
+		while (uinfo->ei_clock < next) {
+			syscall_futex_waitv(NULL, 0, (next - uinfo->ei_clock) / TIMER_INTERVAL + 1);
+		}
+		ipc_send(fsenv, FSREQ_FLUSH, (void *)FLUSHVA, PTE_D);
+		ipc_recv(&whom, 0, 0);
+	}
+}
+
 /*
  * Overview:
  *  The main function of the file system server.
@@ -414,9 +1180,32 @@ int main() {
 
 	debugf("FS is running\n");
 
+	// Fork the flusher before the block cache is populated, so it shares none of it.
+	u_int fsenv = env->env_id;
+	int r = fork();
+	if (r < 0) {
+		user_panic("cannot fork the flusher: %d", r);
+	}
+	if (r == 0) {
+		flusher(fsenv);
+	}
+
 	serve_init();
 	fs_init();
 
+	// Fork the workers, sharing the server state with them.
+	share_init();
+	for (u_int i = 0; i < FS_NWORKERS; i++) {
+		if ((r = fork()) < 0) {
+			user_panic("cannot fork worker %d: %d", i, r);
+		}
+		if (r == 0) {
+			worker(&workers[i]);
+		}
+		workers[i].w_envid = r;
+	}
+	nworkers = FS_NWORKERS;
+
 	serve();
 	return 0;
 }
@@ -2,8 +2,6 @@
 #include <lib.h>
 #include <mmu.h>
 
-#define PTE_DIRTY 0x0004 // file system block cache is dirty
-
 #define SECT_SIZE 512			  /* Bytes per disk sector */
 #define SECT2BLK (BLOCK_SIZE / SECT_SIZE) /* sectors to a block */
 
@@ -14,6 +12,71 @@
 /* Maximum disk size we can handle (1GB) */
 #define DISKMAX 0x40000000
 
+/* Maximum number of disk blocks kept in memory at once. Clean blocks that are
+ * not in use are dropped (and dirty ones written back) to stay within it. */
+#define BCACHE_NPAGES 512
+
+/* Number of slots of the directory lookup cache, which maps (directory, name) to the
+ * 'File' found by the last lookup of that name. */
+#define DCACHE_NSLOTS 1024
+
+/* Delayed write-back: dirty blocks are written once the oldest of them has been dirty
+ * for FLUSH_AGE cycles (see 'CLOCK_MONOTONIC'), or once FLUSH_NDIRTY are dirty. */
+#define FLUSH_AGE (50 * TIMER_INTERVAL)
+#define FLUSH_NDIRTY (BCACHE_NPAGES / 4)
+
+/* Number of worker envs serving requests concurrently. The server env itself only
+ * dispatches the requests to them. */
+#define FS_NWORKERS 4
+
+/* State shared by the server envs. Such variables are placed in pages that are mapped
+ * PTE_LIBRARY before the workers are forked (see 'share_init'), so they must start zeroed. */
+#define FS_SHARED __attribute__((section(".bss.shared")))
+
+/* A lock between the server envs. The holder may be waiting for the disk, so the others
+ * yield to it instead of spinning. */
+typedef volatile u_int fs_lock_t;
+
+static inline int fs_trylock(fs_lock_t *l) {
+	return !__sync_lock_test_and_set(l, 1);
+}
+
+static inline void fs_lock(fs_lock_t *l) {
+	while (!fs_trylock(l)) {
+		syscall_yield();
+	}
+}
+
+static inline void fs_unlock(fs_lock_t *l) {
+	__sync_lock_release(l);
+}
+
+/* A worker env. The dispatcher hands it a request by setting 'w_busy' and sending it the
+ * request page, and serves its page requests (see 'fs_page_alloc'). */
+struct Worker {
+	u_int w_envid;
+	u_int w_busy;  // serving a request, set by the dispatcher and cleared by the worker
+	u_int w_whom;  // client of the request
+	u_int w_pop;   // pending page request (PAGE_ALLOC or PAGE_UNMAP), or 0
+	void *w_pva;   // its page
+	int w_pr;      // and its result
+	u_int w_ring;  // ring the request is in plus one, or 0 if it came with a page
+	u_int w_slot;  // and its entry there
+};
+
+#define PAGE_ALLOC 1
+#define PAGE_UNMAP 2
+
+/* share.c */
+extern struct Worker workers[FS_NWORKERS];
+extern u_int nworkers;
+extern struct Worker *worker_self;
+void share_init(void);
+void share_service(void);
+int fs_page_alloc(void *va);
+int fs_page_unmap(void *va);
+u_int fs_nref(void);
+
 /* ide.c */
 void ide_read(u_int diskno, u_int secno, void *dst, u_int nsecs);
 void ide_write(u_int diskno, u_int secno, void *src, u_int nsecs);
@@ -26,11 +89,29 @@ int file_set_size(struct File *f, u_int newsize);
 void file_close(struct File *f);
 int file_remove(char *path);
 int file_dirty(struct File *f, u_int offset);
+int file_copy(struct File *src, u_int soff, struct File *dst, u_int doff, u_int len);
 void file_flush(struct File *);
+void file_prefetch(struct File *f, u_int filebno, u_int n);
+void file_sync(struct File *f);
+int file_spill(struct File *f);
+int file_inline(struct File *f);
 
 void fs_init(void);
 void fs_sync(void);
+void fs_writeback(void);
 extern uint32_t *bitmap;
 int map_block(u_int);
+void unmap_block(u_int);
+int dirty_block(u_int blockno);
+u_int disk_blockno(void *va);
+void block_pin(u_int blockno);
+void block_unpin(u_int blockno);
+void fs_enter(void);
+void fs_leave(void);
+u_int block_cache_begin_request(void);
+void block_cache_end_request(u_int slot);
+void block_cache_stat(struct BlockCacheStat *stat);
 int alloc_block(void);
+int alloc_extent(u_int n, u_int *nalloc);
+void file_set_type(struct File *f, u_int type);
 int file_get_type(struct File *f);
\ No newline at end of file
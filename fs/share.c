@@ -0,0 +1,111 @@
+/*
+ * Memory shared by the envs of the file system server.
+ *
+ * The server env forks FS_NWORKERS workers once the file system is up. The server state
+ * (block cache bookkeeping, bitmap summary, open file table...) is declared FS_SHARED, and
+ * 'share_init' maps its pages PTE_LIBRARY before the fork, so that all envs see the same
+ * copy. The pages allocated later (cached blocks, Filefd pages) must be shared as well, but
+ * a worker can't map a page into its siblings: it asks the server env, which is the parent
+ * of them all, with 'fs_page_alloc' and 'fs_page_unmap'.
+ */
+
+#include "serv.h"
+
+extern char shared_start[], shared_end[];
+
+struct Worker workers[FS_NWORKERS] FS_SHARED;
+u_int nworkers FS_SHARED;
+
+/* This env, if it is a worker (private to each env). */
+struct Worker *worker_self;
+
+/*
+ * Overview:
+ *  Share the pages of the FS_SHARED variables with the envs forked from now on.
+ */
+void share_init(void) {
+	for (char *va = shared_start; va < shared_end; va += PAGE_SIZE) {
+		panic_on(syscall_mem_map(0, va, 0, va, PTE_D | PTE_LIBRARY));
+	}
+}
+
+/*
+ * Overview:
+ *  Number of references to a page that only the server envs map.
+ */
+u_int fs_nref(void) {
+	return 1 + nworkers;
+}
+
+static int share_alloc(void *va) {
+	int r;
+
+	try(syscall_mem_alloc(0, va, PTE_D | PTE_LIBRARY));
+	for (u_int i = 0; i < nworkers; i++) {
+		if ((r = syscall_mem_map(0, va, workers[i].w_envid, va, PTE_D | PTE_LIBRARY)) < 0) {
+			while (i-- > 0) {
+				panic_on(syscall_mem_unmap(workers[i].w_envid, va));
+			}
+			panic_on(syscall_mem_unmap(0, va));
+			return r;
+		}
+	}
+	return 0;
+}
+
+static int share_unmap(void *va) {
+	for (u_int i = 0; i < nworkers; i++) {
+		panic_on(syscall_mem_unmap(workers[i].w_envid, va));
+	}
+	return syscall_mem_unmap(0, va);
+}
+
+/*
+ * Overview:
+ *  Ask the server env to run page request 'op' on 'va' for this worker, and wait for it.
+ *  The server env may be blocked waiting for a client, so keep waking it up.
+ */
+static int page_request(u_int op, void *va) {
+	worker_self->w_pva = va;
+	__sync_synchronize();
+	worker_self->w_pop = op;
+	while (worker_self->w_pop) {
+		syscall_ipc_try_send(envs[1].env_id, 0, 0, 0);
+		syscall_yield();
+	}
+	return worker_self->w_pr;
+}
+
+/*
+ * Overview:
+ *  Allocate a page at 'va' in all the server envs.
+ *
+ * Post-Condition:
+ *  Return 0 on success, or the error of 'syscall_mem_alloc' / 'syscall_mem_map'.
+ */
+int fs_page_alloc(void *va) {
+	return worker_self ? page_request(PAGE_ALLOC, va) : share_alloc(va);
+}
+
+/*
+ * Overview:
+ *  Unmap the page at 'va' from all the server envs.
+ */
+int fs_page_unmap(void *va) {
+	return worker_self ? page_request(PAGE_UNMAP, va) : share_unmap(va);
+}
+
+/*
+ * Overview:
+ *  Run the pending page requests of the workers. Called by the server env.
+ */
+void share_service(void) {
+	for (u_int i = 0; i < nworkers; i++) {
+		struct Worker *w = &workers[i];
+		if (w->w_pop) {
+			w->w_pr = w->w_pop == PAGE_ALLOC ? share_alloc(w->w_pva) : share_unmap(w->w_pva);
+			__sync_synchronize();
+			w->w_pop = 0;
+		}
+	}
+}
@@ -15,6 +15,31 @@
 #define ENV_RUNNABLE 1
 #define ENV_NOT_RUNNABLE 2
 
+// Max number of pages a single 'sys_ipc_try_send_pages' may map.
+#define IPC_MAXPAGES 64
+
+// A word to block on with 'sys_futex_waitv': the wait ends when it is woken up, or at once if
+// it no longer holds 'wk_val'. A zero 'wk_va' stands for console input instead.
+struct WaitKey {
+	u_int wk_va;
+	u_int wk_val;
+};
+
+// Max number of words a single 'sys_futex_waitv' may block on.
+#define NWAITKEY 16
+
+// Read-only page mapped at 'UINFO' in each env, refreshed by the kernel on every 'env_run'.
+// User programs read it directly instead of trapping for their own id or the time.
+struct EnvInfo {
+	u_int ei_envid;	    // env_id of this env
+	u_int ei_parent_id; // env_id of this env's parent
+	u_int ei_runs;	    // number of times this env has been env_run'ed
+	u_int ei_ticks;	    // timer interrupts since boot
+	uint64_t ei_clock;  // CLOCK_MONOTONIC when this env was last resumed
+	uint64_t ei_utime;  // 'env_utime' when this env was last resumed
+	uint64_t ei_stime;  // 'env_stime' when this env was last resumed
+};
+
 // Control block of an environment (process).
 struct Env {
 	struct Trapframe env_tf;	 // saved context (registers) before switching
@@ -33,12 +58,29 @@ struct Env {
 	u_int env_ipc_recving; // whether this env is blocked receiving
 	u_int env_ipc_dstva;   // va at which the received page should be mapped
 	u_int env_ipc_perm;    // perm in which the received page should be mapped
+	u_int env_ipc_npages;  // pages accepted at 'env_ipc_dstva', then the number received
 
 	// Lab 4 fault handling
 	u_int env_user_tlb_mod_entry; // userspace TLB Mod handler
+	u_int env_user_pgfault_entry; // userspace handler of faults on unmapped pages in the range
+	u_int env_pgfault_start;      // ['env_pgfault_start', 'env_pgfault_end')
+	u_int env_pgfault_end;
 
 	// Lab 6 scheduler counts
 	u_int env_runs; // number of times we've been env_run'ed
+
+	// CPU time accounting, in CP0_COUNT cycles (see kern/kclock.c)
+	uint64_t env_utime; // time spent running in user mode
+	uint64_t env_stime; // time spent in the kernel on behalf of this env
+
+	struct EnvInfo *env_info; // kernel address of the page mapped at 'UINFO'
+
+	// Wait on user words (see kern/wait.c)
+	LIST_ENTRY(Env) env_wait_link;	 // intrusive entry in the list of waiting envs
+	u_int env_waiting;		 // whether this env is in that list
+	u_int env_wait_keys[NWAITKEY]; // physical addresses of the words (or 'WAIT_CONS')
+	u_int env_wait_nkeys;		 // number of keys
+	u_int env_wait_until;		 // 'kclock_ticks' at which the wait times out, 0 if never
 };
 
 #define MAXJOBS 1000
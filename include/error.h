@@ -44,6 +44,12 @@
 // File not a valid executable
 #define E_NOT_EXEC 13
 
+// A wait ran out of time before it was woken up
+#define E_TIMEOUT 14
+
+// A syscall was handed user memory that only the user page fault handler can map
+#define E_FAULT 15
+
 /*
  * A quick wrapper around function calls to propagate errors.
  * Use this with caution, as it leaks resources we've acquired so far.
@@ -1,10 +1,11 @@
 #ifndef _KCLOCK_H_
 #define _KCLOCK_H_
 
-#include <asm/asm.h>
-
 #define TIMER_INTERVAL (500000) // WARNING: DO NOT MODIFY THIS LINE!
 
+#ifdef __ASSEMBLER__
+#include <asm/asm.h>
+
 // clang-format off
 .macro RESET_KCLOCK
 	li 	t0, TIMER_INTERVAL
@@ -17,9 +18,35 @@
 	 *
 	 */
 	/* Exercise 3.11: Your code here. */
-	mtc0	t0,CP0_COMPARE
-	li		t0,0
-	mtc0	t0,CP0_COUNT
+	/*
+	 * CP0_COUNT is left running so that 'kclock_read' can extend it into a monotonic clock;
+	 * the next tick is armed TIMER_INTERVAL cycles from now instead.
+	 */
+	mfc0	t1, CP0_COUNT
+	addu	t0, t0, t1
+	mtc0	t0, CP0_COMPARE
 .endm
 // clang-format on
+
+#else
+
+#include <types.h>
+
+// Clocks readable by 'sys_clock_gettime', all counted in CP0_COUNT cycles.
+#define CLOCK_MONOTONIC 0 // time since boot
+#define CLOCK_ENV_CPUTIME 1 // user plus system time of the calling env
+
+struct Trapframe;
+
+extern u_int kclock_ticks;
+
+void kclock_tick(struct Trapframe *tf);
+
+uint64_t kclock_read(void);
+void cputime_enter(struct Trapframe *tf);
+void cputime_exit(struct Trapframe *tf);
+uint64_t cputime_pending(uint64_t now);
+void cputime_switch(void);
+
+#endif /* __ASSEMBLER__ */
 #endif
@@ -3,6 +3,9 @@
 
 void printcharc(char ch);
 int scancharc(void);
+int cons_ready(void);
+int cons_drain(void);
+void cons_flush(void);
 void halt(void) __attribute__((noreturn));
 
 #endif
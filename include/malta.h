@@ -12,9 +12,12 @@
  */
 #define MALTA_SERIAL_BASE (MALTA_PCIIO_BASE + 0x3f8)
 #define MALTA_SERIAL_DATA (MALTA_SERIAL_BASE + 0x0)
+#define MALTA_SERIAL_FCR (MALTA_SERIAL_BASE + 0x2)
 #define MALTA_SERIAL_LSR (MALTA_SERIAL_BASE + 0x5)
 #define MALTA_SERIAL_DATA_READY 0x1
 #define MALTA_SERIAL_THR_EMPTY 0x20
+#define MALTA_SERIAL_FIFO_ENABLE 0x07 /* enable FIFOs and clear both of them */
+#define MALTA_SERIAL_FIFO_SIZE 16
 
 /*
  * Intel PIIX4 IDE Controller device definitions.
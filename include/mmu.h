@@ -65,6 +65,12 @@
 // Shared memmory. Reserved for software, used by fork.
 #define PTE_LIBRARY 0x0002
 
+// Write tracking. Reserved for software: a writable page mapped without PTE_D. The kernel sets
+// PTE_D and PTE_DIRTY on its first store (see 'do_tlb_mod'), so the user can tell which pages
+// have been written. Used by the file system client.
+#define PTE_WTRACK 0x0004
+#define PTE_DIRTY 0x0008
+
 // Memory segments (32-bit kernel mode addresses)
 #define KUSEG 0x00000000U
 #define KSEG0 0x80000000U
@@ -96,13 +102,15 @@
  o                      |           pages            |     PDMAP                 |
  o      UPAGES   -----> +----------------------------+------------0x7f80 0000    |
  o                      |           envs             |     PDMAP                 |
- o  UTOP,UENVS   -----> +----------------------------+------------0x7f40 0000    |
+ o      UENVS    -----> +----------------------------+------------0x7f40 0000    |
+ o                      |     env info (one page)    |     PDMAP                 |
+ o  UTOP,UINFO   -----> +----------------------------+------------0x7f00 0000    |
  o  UXSTACKTOP -/       |     user exception stack   |     PTMAP                 |
- o                      +----------------------------+------------0x7f3f f000    |
+ o                      +----------------------------+------------0x7eff f000    |
  o                      |                            |     PTMAP                 |
- o      USTACKTOP ----> +----------------------------+------------0x7f3f e000    |
+ o      USTACKTOP ----> +----------------------------+------------0x7eff e000    |
  o                      |     normal user stack      |     PTMAP                 |
- o                      +----------------------------+------------0x7f3f d000    |
+ o                      +----------------------------+------------0x7eff d000    |
  a                      |                            |                           |
  a                      ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~                           |
  a                      .                            .                           |
@@ -128,8 +136,9 @@
 #define UVPT (ULIM - PDMAP)
 #define UPAGES (UVPT - PDMAP)
 #define UENVS (UPAGES - PDMAP)
+#define UINFO (UENVS - PDMAP)
 
-#define UTOP UENVS
+#define UTOP UINFO
 #define UXSTACKTOP UTOP
 
 #define USTACKTOP (UTOP - 2 * PTMAP)
@@ -183,6 +192,7 @@ typedef u_long Pte;
 	})
 
 extern void tlb_out(u_int entryhi);
+extern void do_tlb_refill(void);
 void tlb_invalidate(u_int asid, u_long va);
 #endif //!__ASSEMBLER__
 #endif // !_MMU_H_
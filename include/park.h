@@ -0,0 +1,14 @@
+#ifndef _PARK_H_
+#define _PARK_H_
+
+#include <pmap.h>
+
+// Max number of pages parked at the same time, over all envs.
+#define NPARK 256
+
+int park_page(u_int key, struct Page *pp);
+struct Page *park_lookup(u_int key);
+void park_drop(u_int key);
+void park_release(struct Page *pp);
+
+#endif // _PARK_H_
@@ -3,8 +3,24 @@
 
 #include <machine.h>
 #include <stdarg.h>
+#include <types.h>
+
+/*
+ * Kernel log levels. Every message is kept in the kernel log ring (see 'sys_read_klog'); only
+ * those at or below 'KLOG_CONSOLE_LEVEL' are also sent to the console.
+ */
+#define KLOG_ERR 0
+#define KLOG_WARN 1
+#define KLOG_INFO 2
+#define KLOG_DEBUG 3
+
+#ifndef KLOG_CONSOLE_LEVEL
+#define KLOG_CONSOLE_LEVEL KLOG_INFO
+#endif
 
 void printk(const char *fmt, ...);
+void klog(int level, const char *fmt, ...);
+int klog_read(char *buf, u_int len, u_int *offset);
 
 void _panic(const char *, int, const char *, const char *, ...)
 #ifdef MOS_HANG_ON_PANIC
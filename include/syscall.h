@@ -27,6 +27,16 @@ enum {
 	SYS_print_job,
 	SYS_add_job,
 	SYS_done_job,
+	SYS_read_klog,
+	SYS_clock_gettime,
+	SYS_ipc_recv_pages,
+	SYS_ipc_try_send_pages,
+	SYS_set_pgfault_entry,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_page_park,
+	SYS_page_unpark,
+	SYS_futex_waitv,
 	MAX_SYSNO,
 };
 
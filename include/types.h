@@ -16,6 +16,13 @@ typedef unsigned long u_long;
 		__a <= __b ? __a : __b;                                                            \
 	})
 
+#define MAX(_a, _b)                                                                                \
+	({                                                                                         \
+		typeof(_a) __a = (_a);                                                             \
+		typeof(_b) __b = (_b);                                                             \
+		__a >= __b ? __a : __b;                                                            \
+	})
+
 /* Rounding; only works for n = power of two */
 #define ROUND(a, n) (((((u_long)(a)) + (n)-1)) & ~((n)-1))
 #define ROUNDDOWN(a, n) (((u_long)(a)) & ~((n)-1))
@@ -0,0 +1,15 @@
+#ifndef _WAIT_H_
+#define _WAIT_H_
+
+#include <env.h>
+
+// Key of a wait for console input. Word keys are aligned physical addresses, so it can't
+// clash with them.
+#define WAIT_CONS 1
+
+void wait_block(const u_int *keys, u_int nkeys, u_int ticks);
+int wait_wake(u_int key, u_int n);
+void wait_tick(void);
+void wait_cancel(struct Env *e);
+
+#endif // _WAIT_H_
@@ -1,10 +1,12 @@
 #include <asm/cp0regdef.h>
 #include <elf.h>
 #include <env.h>
+#include <kclock.h>
 #include <mmu.h>
 #include <pmap.h>
 #include <printk.h>
 #include <sched.h>
+#include <wait.h>
 
 struct Env envs[NENV] __attribute__((aligned(PAGE_SIZE))); // All environments
 
@@ -197,6 +199,7 @@ static int env_setup_vm(struct Env *e) {
 	 *   You can get the kernel address of a specified physical page using 'page2kva'.
 	 */
 	struct Page *p;
+	int r;
 	try(page_alloc(&p));
 	/* Exercise 3.3: Your code here. */
 	p->pp_ref ++;
@@ -212,9 +215,38 @@ static int env_setup_vm(struct Env *e) {
 	/* Step 3: Map its own page table at 'UVPT' with readonly permission.
 	 * As a result, user programs can read its page table through 'UVPT' */
 	e->env_pgdir[PDX(UVPT)] = PADDR(e->env_pgdir) | PTE_V;
+
+	/* Step 4: Map a private info page at 'UINFO' with readonly permission.
+	 * Unlike 'UENVS' and 'UPAGES', it lives in a page table of its own, which is released
+	 * together with the user pages in 'env_free'. */
+	if ((r = page_alloc(&p)) != 0) {
+		page_decref(pa2page(PADDR(e->env_pgdir)));
+		return r;
+	}
+	if ((r = page_insert(e->env_pgdir, 0, p, UINFO, 0)) != 0) {
+		page_free(p);
+		page_decref(pa2page(PADDR(e->env_pgdir)));
+		return r;
+	}
+	e->env_info = (struct EnvInfo *)page2kva(p);
 	return 0;
 }
 
+/* Overview:
+ *   Refresh the info page of 'e' from its Env and the kernel clock.
+ */
+static void env_info_update(struct Env *e) {
+	struct EnvInfo *ei = e->env_info;
+
+	ei->ei_envid = e->env_id;
+	ei->ei_parent_id = e->env_parent_id;
+	ei->ei_runs = e->env_runs;
+	ei->ei_ticks = kclock_ticks;
+	ei->ei_clock = kclock_read();
+	ei->ei_utime = e->env_utime;
+	ei->ei_stime = e->env_stime;
+}
+
 /* Overview:
  *   Allocate and initialize a new env.
  *   On success, the new env is stored at '*new'.
@@ -259,13 +291,18 @@ int env_alloc(struct Env **new, u_int parent_id) {
 	 *   Use 'mkenvid' to allocate a free envid.
 	 */
 	e->env_user_tlb_mod_entry = 0; // for lab4
+	e->env_user_pgfault_entry = 0;
+	e->env_waiting = 0;
 	e->env_runs = 0;	       // for lab6
+	e->env_utime = 0;
+	e->env_stime = 0;
 	/* Exercise 3.4: Your code here. (3/4) */
 	e->env_id = mkenvid(e);
 	if ((r = asid_alloc(&(e->env_asid))) != 0) {
 		return r;
 	}
 	e->env_parent_id = parent_id;
+	env_info_update(e);
 	/* Step 4: Initialize the sp and 'cp0_status' in 'e->env_tf'.
 	 *   Set the EXL bit to ensure that the processor remains in kernel mode during context
 	 * recovery. Additionally, set UM to 1 so that when ERET unsets EXL, the processor
@@ -387,10 +424,11 @@ void env_free(struct Env *e) {
 	u_int pdeno, pteno, pa;
 
 	/* Hint: Note the environment's demise.*/
-	printk("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+	klog(KLOG_DEBUG, "[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
-	/* Hint: Flush all mapped pages in the user portion of the address space */
-	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+	/* Hint: Flush all mapped pages in the user portion of the address space, and the info
+	 * page at 'UINFO' (which is 'UTOP') with its page table. */
+	for (pdeno = 0; pdeno <= PDX(UINFO); pdeno++) {
 		/* Hint: only look at mapped page tables. */
 		if (!(e->env_pgdir[pdeno] & PTE_V)) {
 			continue;
@@ -418,9 +456,12 @@ void env_free(struct Env *e) {
 	/* Hint: invalidate page directory in TLB */
 	tlb_invalidate(e->env_asid, UVPT + (PDX(UVPT) << PGSHIFT));
 	/* Hint: return the environment to the free list. */
+	wait_cancel(e);
 	e->env_status = ENV_FREE;
 	LIST_INSERT_HEAD((&env_free_list), (e), env_link);
 	TAILQ_REMOVE(&env_sched_list, (e), env_sched_link);
+	/* Wake up the envs waiting for 'e' to exit, on its 'env_status' mapped at 'UENVS'. */
+	wait_wake(PADDR(&e->env_status), 0);
 }
 
 /* Overview:
@@ -433,7 +474,7 @@ void env_destroy(struct Env *e) {
 	/* Hint: schedule to run a new environment. */
 	if (curenv == e) {
 		curenv = NULL;
-		printk("i am killed ... \n");
+		klog(KLOG_DEBUG, "i am killed ... \n");
 		schedule(1);
 	}
 }
@@ -471,10 +512,12 @@ void env_run(struct Env *e) {
 	if (curenv) {
 		curenv->env_tf = *((struct Trapframe *)KSTACKTOP - 1);
 	}
+	cputime_switch();
 
 	/* Step 2: Change 'curenv' to 'e'. */
 	curenv = e;
 	curenv->env_runs++; // lab6
+	env_info_update(curenv);
 
 	/* Step 3: Change 'cur_pgdir' to 'curenv->env_pgdir', switching to its address space. */
 	/* Exercise 3.8: Your code here. (1/2) */
@@ -538,7 +581,9 @@ void env_check() {
 	/* check env_setup_vm() work well */
 	printk("pe1->env_pgdir %x\n", pe1->env_pgdir);
 
-	assert(pe2->env_pgdir[PDX(UTOP)] == base_pgdir[PDX(UTOP)]);
+	assert(pe2->env_pgdir[PDX(UENVS)] == base_pgdir[PDX(UENVS)]);
+	assert(pe2->env_pgdir[PDX(UINFO)] != pe1->env_pgdir[PDX(UINFO)]);
+	assert(va2pa(pe2->env_pgdir, UINFO) == PADDR(pe2->env_info));
 	assert(pe2->env_pgdir[PDX(UTOP) - 1] == 0);
 	printk("env_setup_vm passed!\n");
 
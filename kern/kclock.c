@@ -0,0 +1,90 @@
+#include <asm/cp0regdef.h>
+#include <env.h>
+#include <kclock.h>
+#include <wait.h>
+
+u_int kclock_ticks; // timer interrupts since boot
+
+static uint64_t kclock_cycles; // value of the clock at the last 'kclock_read'
+static u_int kclock_last;      // CP0_COUNT at the last 'kclock_read'
+static uint64_t cputime_stamp; // time at which the running env last crossed the kernel boundary
+
+/* Overview:
+ *   Return the number of CP0_COUNT cycles since boot as a 64-bit monotonic value.
+ *
+ * Note:
+ *   CP0_COUNT is only 32 bits wide, so a wrap is detected by the unsigned difference against the
+ *   previous reading. This is exact as long as the clock is read at least once per 2^32 cycles,
+ *   which the timer interrupt (every TIMER_INTERVAL cycles) guarantees.
+ */
+uint64_t kclock_read(void) {
+	u_int count;
+
+	asm volatile("mfc0 %0, $9" : "=r"(count));
+	kclock_cycles += (u_int)(count - kclock_last);
+	kclock_last = count;
+	return kclock_cycles;
+}
+
+/* Overview:
+ *   Called on every timer interrupt, before the scheduler runs.
+ */
+void kclock_tick(struct Trapframe *tf) {
+	kclock_ticks++;
+	cputime_enter(tf);
+	wait_tick();
+}
+
+/* Overview:
+ *   Called on every exception entry. If the exception came from user mode, charge the cycles
+ *   since the env was last resumed to its user time.
+ *   Exceptions taken in kernel mode (e.g. a TLB miss while copying from user space) are part
+ *   of the surrounding system time and are ignored.
+ */
+void cputime_enter(struct Trapframe *tf) {
+	uint64_t now;
+
+	if (curenv == NULL || !(tf->cp0_status & STATUS_UM)) {
+		return;
+	}
+	now = kclock_read();
+	curenv->env_utime += now - cputime_stamp;
+	cputime_stamp = now;
+}
+
+/* Overview:
+ *   Called when an exception handler is about to return. If we are going back to user mode,
+ *   charge the cycles spent in the kernel to the system time of 'curenv'.
+ */
+void cputime_exit(struct Trapframe *tf) {
+	uint64_t now;
+
+	if (curenv == NULL || !(tf->cp0_status & STATUS_UM)) {
+		return;
+	}
+	now = kclock_read();
+	curenv->env_stime += now - cputime_stamp;
+	cputime_stamp = now;
+}
+
+/* Overview:
+ *   Return the cycles since the running env last crossed the kernel boundary, which are not yet
+ *   charged to it.
+ */
+uint64_t cputime_pending(uint64_t now) {
+	return now - cputime_stamp;
+}
+
+/* Overview:
+ *   Called by 'env_run' right before 'curenv' is replaced. The kernel time since the last
+ *   exception entry (including scheduling) is charged to the outgoing env, and the clock is
+ *   restarted for the incoming one.
+ */
+void cputime_switch(void) {
+	uint64_t now = kclock_read();
+
+	if (curenv != NULL) {
+		curenv->env_stime += now - cputime_stamp;
+	}
+	cputime_stamp = now;
+}
@@ -49,6 +49,7 @@ void _panic(const char *file, int line, const char *func, const char *fmt, ...)
 #endif
 
 #ifdef MOS_HANG_ON_PANIC
+	cons_flush();
 	while (1) {
 	}
 #else
@@ -0,0 +1,89 @@
+#include <env.h>
+#include <park.h>
+
+// Pages handed from an env to another without an IPC rendezvous: the sender parks a page
+// under a key, and the receiver maps it later. As for 'sys_futex_wait', a key is the physical
+// address of a user word, normally in a page both envs share, which names the slot.
+struct Park {
+	u_int pk_key;	     // physical address of the word naming the slot, 0 if free
+	struct Page *pk_page; // the parked page, referenced by the slot
+};
+
+static struct Park parks[NPARK];
+static u_int nparked;
+
+static struct Park *park_find(u_int key) {
+	for (u_int i = 0; i < NPARK; i++) {
+		if (parks[i].pk_key == key) {
+			return &parks[i];
+		}
+	}
+	return NULL;
+}
+
+/* Overview:
+ *   Park 'pp' under 'key', taking a reference to it.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_INVAL if a page is already parked under 'key'.
+ *   Return -E_NO_MEM if all NPARK slots are in use.
+ */
+int park_page(u_int key, struct Page *pp) {
+	struct Park *pk;
+
+	if (park_find(key) != NULL) {
+		return -E_INVAL;
+	}
+	if ((pk = park_find(0)) == NULL) {
+		return -E_NO_MEM;
+	}
+	pk->pk_key = key;
+	pk->pk_page = pp;
+	pp->pp_ref++;
+	nparked++;
+	return 0;
+}
+
+/* Overview:
+ *   Return the page parked under 'key', or NULL if there is none.
+ */
+struct Page *park_lookup(u_int key) {
+	struct Park *pk = park_find(key);
+
+	return pk ? pk->pk_page : NULL;
+}
+
+static void park_free(struct Park *pk) {
+	struct Page *pp = pk->pk_page;
+
+	pk->pk_key = 0;
+	pk->pk_page = NULL;
+	nparked--;
+	page_decref(pp);
+}
+
+/* Overview:
+ *   Drop the page parked under 'key', if any.
+ */
+void park_drop(u_int key) {
+	struct Park *pk = park_find(key);
+
+	if (pk != NULL) {
+		park_free(pk);
+	}
+}
+
+/* Overview:
+ *   Called when 'pp' is freed: drop the pages parked under keys inside it, which nobody can
+ *   name any more.
+ */
+void park_release(struct Page *pp) {
+	u_int pa = page2pa(pp);
+
+	for (u_int i = 0; nparked > 0 && i < NPARK; i++) {
+		if (parks[i].pk_key != 0 && ROUNDDOWN(parks[i].pk_key, PAGE_SIZE) == pa) {
+			park_free(&parks[i]);
+		}
+	}
+}
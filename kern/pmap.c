@@ -2,6 +2,7 @@
 #include <env.h>
 #include <malta.h>
 #include <mmu.h>
+#include <park.h>
 #include <pmap.h>
 #include <printk.h>
 /* These variables are set by mips_detect_memory(ram_low_size); */
@@ -290,6 +291,9 @@ void page_decref(struct Page *pp) {
 
 	/* If 'pp_ref' reaches to 0, free this page. */
 	if (--pp->pp_ref == 0) {
+#if !defined(LAB) || LAB >= 4
+		park_release(pp);
+#endif
 		page_free(pp);
 	}
 }
@@ -2,10 +2,43 @@
 #include <printk.h>
 #include <trap.h>
 
+/*
+ * Kernel log ring. Each line is stored with a "<level>" prefix, and 'klog_head' counts every
+ * byte ever logged, so readers can name a position with a plain offset.
+ */
+#define KLOG_SIZE 16384
+
+static char klog_buf[KLOG_SIZE];
+static u_int klog_head;
+static int klog_line_level = -1; // level of the line being logged, -1 at the start of a line
+
+static void klog_putc(char c) {
+	klog_buf[klog_head % KLOG_SIZE] = c;
+	klog_head++;
+}
+
 /* Lab 1 Key Code "outputk" */
+/* Overview:
+ *   'vprintfmt' sink of the kernel log. 'data' points to the log level, or is NULL for
+ *   'KLOG_INFO'. Accepted lines are queued to the console, which is drained asynchronously.
+ */
 void outputk(void *data, const char *buf, size_t len) {
+	int level = data ? *(int *)data : KLOG_INFO;
+
 	for (int i = 0; i < len; i++) {
-		printcharc(buf[i]);
+		if (klog_line_level < 0) {
+			klog_line_level = level;
+			klog_putc('<');
+			klog_putc('0' + level);
+			klog_putc('>');
+		}
+		klog_putc(buf[i]);
+		if (klog_line_level <= KLOG_CONSOLE_LEVEL) {
+			printcharc(buf[i]);
+		}
+		if (buf[i] == '\n') {
+			klog_line_level = -1;
+		}
 	}
 }
 /* End of Key Code "outputk" */
@@ -19,6 +52,41 @@ void printk(const char *fmt, ...) {
 }
 /* End of Key Code "printk" */
 
+/* Overview:
+ *   Log a message at 'level'. Use 'KLOG_DEBUG' on hot paths: such lines only go to the log ring
+ *   and never wait for the UART.
+ */
+void klog(int level, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	vprintfmt(outputk, &level, fmt, ap);
+	va_end(ap);
+}
+
+/* Overview:
+ *   Copy at most 'len' bytes of the log ring, starting at offset '*offset', into 'buf'.
+ *   If the bytes at '*offset' have already been overwritten, start at the oldest byte kept.
+ *
+ * Post-Condition:
+ *   '*offset' is advanced past the copied bytes. Return the number of bytes copied.
+ */
+int klog_read(char *buf, u_int len, u_int *offset) {
+	u_int off = *offset;
+	u_int n;
+
+	if (off > klog_head) {
+		off = klog_head;
+	}
+	if (klog_head - off > KLOG_SIZE) {
+		off = klog_head - KLOG_SIZE;
+	}
+	for (n = 0; n < len && off != klog_head; n++, off++) {
+		buf[n] = klog_buf[off % KLOG_SIZE];
+	}
+	*offset = off;
+	return n;
+}
+
 void print_tf(struct Trapframe *tf) {
 	for (int i = 0; i < sizeof(tf->regs) / sizeof(tf->regs[0]); i++) {
 		printk("$%2d = %08x\n", i, tf->regs[i]);
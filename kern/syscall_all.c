@@ -1,10 +1,14 @@
 #include <env.h>
 #include <io.h>
+#include <kclock.h>
+#include <machine.h>
 #include <mmu.h>
+#include <park.h>
 #include <pmap.h>
 #include <printk.h>
 #include <sched.h>
 #include <syscall.h>
+#include <wait.h>
 
 extern struct Env *curenv;
 int id = 1;
@@ -22,8 +26,31 @@ void sys_putchar(int c) {
 	return;
 }
 
+/* Overview:
+ *   Check whether the legal user range ['va', 'va' + 'len') has a page that is not mapped yet
+ *   in the range 'curenv' registered with 'sys_set_pgfault_entry'. Such a page (of an open
+ *   file, say) is only mapped by the user handler, which can't run for an access made by the
+ *   kernel: the TLB refill would back it with a fresh zero page instead (see 'passive_alloc').
+ *   The library touches these pages before the syscalls that take a buffer.
+ */
+static int is_unfaulted_range(u_long va, u_int len) {
+	if (curenv->env_user_pgfault_entry == 0) {
+		return 0;
+	}
+	for (u_long p = ROUNDDOWN(va, PAGE_SIZE); p < va + len; p += PAGE_SIZE) {
+		if (p >= curenv->env_pgfault_start && p < curenv->env_pgfault_end &&
+		    page_lookup(curenv->env_pgdir, p, NULL) == NULL) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /* Overview:
  * 	This function is used to print a string of bytes on screen.
+ * 	The bytes are only copied into the console output ring, and the UART is fed with
+ * 	whatever it takes right now (and whenever the ring fills); the rest is drained later
+ * 	by 'schedule'.
  *
  * Pre-Condition:
  * 	`s` is base address of the string, and `num` is length of the string.
@@ -32,10 +59,14 @@ int sys_print_cons(const void *s, u_int num) {
 	if (((u_int)s + num) > UTOP || ((u_int)s) >= UTOP || (s > s + num)) {
 		return -E_INVAL;
 	}
+	if (is_unfaulted_range((u_long)s, num)) {
+		return -E_FAULT;
+	}
 	u_int i;
 	for (i = 0; i < num; i++) {
 		printcharc(((char *)s)[i]);
 	}
+	cons_drain();
 	return 0;
 }
 
@@ -81,7 +112,7 @@ int sys_env_destroy(u_int envid) {
 	struct Env *e;
 	try(envid2env(envid, &e, 1));
 
-	printk("[%08x] destroying %08x\n", curenv->env_id, e->env_id);
+	klog(KLOG_DEBUG, "[%08x] destroying %08x\n", curenv->env_id, e->env_id);
 	env_destroy(e);
 	return 0;
 }
@@ -120,6 +151,29 @@ static inline int is_illegal_va_range(u_long va, u_int len) {
 	return va + len < va || va < UTEMP || va + len > UTOP;
 }
 
+/* Overview:
+ *   Register the page fault handler entry of 'envid': from now on, a user-mode access to an
+ *   unmapped page in ['start', 'end') is handed to 'func' instead of being backed by a fresh
+ *   page (see 'do_tlb_miss'). A zero 'func' unregisters the handler.
+ *
+ * Post-Condition:
+ *   Returns 0 on success.
+ *   Returns -E_INVAL if 'func' is not zero and ['start', 'end') is not a legal user range.
+ *   Returns the original error if underlying calls fail.
+ */
+int sys_set_pgfault_entry(u_int envid, u_int func, u_int start, u_int end) {
+	struct Env *env;
+
+	if (func != 0 && (start >= end || is_illegal_va_range(start, end - start))) {
+		return -E_INVAL;
+	}
+	try(envid2env(envid, &env, 1));
+	env->env_user_pgfault_entry = func;
+	env->env_pgfault_start = start;
+	env->env_pgfault_end = end;
+	return 0;
+}
+
 /* Overview:
  *   Allocate a physical page and map 'va' to it with 'perm' in the address space of 'envid'.
  *   If 'va' is already mapped, that original page is sliently unmapped.
@@ -308,6 +362,9 @@ int sys_set_trapframe(u_int envid, struct Trapframe *tf) {
 	if (is_illegal_va_range((u_long)tf, sizeof *tf)) {
 		return -E_INVAL;
 	}
+	if (is_unfaulted_range((u_long)tf, sizeof *tf)) {
+		return -E_FAULT;
+	}
 	struct Env *env;
 	try(envid2env(envid, &env, 1));
 	if (env == curenv) {
@@ -351,6 +408,7 @@ int sys_ipc_recv(u_int dstva) {
 	/* Step 3: Set the value of 'curenv->env_ipc_dstva'. */
 	/* Exercise 4.8: Your code here. (2/8) */
 	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_npages = 1;
 	/* Step 4: Set the status of 'curenv' to 'ENV_NOT_RUNNABLE' and remove it from
 	 * 'env_sched_list'. */
 	/* Exercise 4.8: Your code here. (3/8) */
@@ -401,6 +459,7 @@ int sys_ipc_try_send(u_int envid, u_int value, u_int srcva, u_int perm) {
 	e->env_ipc_from = curenv->env_id;
 	e->env_ipc_perm = PTE_V | perm;
 	e->env_ipc_recving = 0;
+	e->env_ipc_npages = srcva != 0;
 
 	/* Step 5: Set the target's status to 'ENV_RUNNABLE' again and insert it to the tail of
 	 * 'env_sched_list'. */
@@ -421,6 +480,88 @@ int sys_ipc_try_send(u_int envid, u_int value, u_int srcva, u_int perm) {
 	return 0;
 }
 
+/* Overview:
+ *   Like 'sys_ipc_recv', but accept up to 'npages' pages, to be mapped at consecutive
+ *   addresses starting from 'dstva'.
+ *
+ * Post-Condition:
+ *   Return 0 on success. 'env_ipc_npages' tells how many pages were received.
+ *   Return -E_INVAL: 'dstva' is illegal, or 'npages' is 0 or larger than IPC_MAXPAGES.
+ */
+int sys_ipc_recv_pages(u_int dstva, u_int npages) {
+	if (npages == 0 || npages > IPC_MAXPAGES ||
+	    is_illegal_va_range(dstva, npages * PAGE_SIZE)) {
+		return -E_INVAL;
+	}
+
+	curenv->env_ipc_recving = 1;
+	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_npages = npages;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	TAILQ_REMOVE(&env_sched_list, curenv, env_sched_link);
+	((struct Trapframe *)KSTACKTOP - 1)->regs[2] = 0;
+	schedule(1);
+}
+
+/* Overview:
+ *   Try to send a 'value' together with 'npages' pages to the target env 'envid'. 'srcvas' is
+ *   an array of 'npages' page addresses in 'curenv'; the i-th of them is mapped at
+ *   'env_ipc_dstva + i * PAGE_SIZE' in the target, all with 'perm'.
+ *   This lets a server hand out many pages that are scattered in its own address space with
+ *   a single IPC, instead of a send/recv round trip per page.
+ *
+ * Post-Condition:
+ *   Return 0 on success, and the target env is updated as in 'sys_ipc_try_send', with
+ *   'env_ipc_npages' set to 'npages'.
+ *
+ *   Return -E_IPC_NOT_RECV if the target is not waiting for a message.
+ *   Return -E_INVAL if 'srcvas' or any of its entries is illegal or not mapped, or if the
+ *   target accepts fewer than 'npages' pages.
+ *   Return the original error when underlying calls fail.
+ */
+int sys_ipc_try_send_pages(u_int envid, u_int value, u_int srcvas, u_int npages, u_int perm) {
+	struct Env *e;
+	struct Page *p;
+	u_int *va = (u_int *)srcvas;
+
+	if (npages == 0 || npages > IPC_MAXPAGES ||
+	    is_illegal_va_range(srcvas, npages * sizeof(u_int))) {
+		return -E_INVAL;
+	}
+	if (is_unfaulted_range(srcvas, npages * sizeof(u_int))) {
+		return -E_FAULT;
+	}
+	try(envid2env(envid, &e, 0));
+	if (e->env_ipc_recving == 0) {
+		return -E_IPC_NOT_RECV;
+	}
+	if (e->env_ipc_dstva == 0 || npages > e->env_ipc_npages) {
+		return -E_INVAL;
+	}
+	// Check every source page before waking the target up, so that a bad request leaves
+	// it still waiting.
+	for (u_int i = 0; i < npages; i++) {
+		if (is_illegal_va(va[i]) || page_lookup(curenv->env_pgdir, va[i], NULL) == NULL) {
+			return -E_INVAL;
+		}
+	}
+
+	e->env_ipc_value = value;
+	e->env_ipc_from = curenv->env_id;
+	e->env_ipc_perm = PTE_V | perm;
+	e->env_ipc_recving = 0;
+	e->env_ipc_npages = npages;
+	e->env_status = ENV_RUNNABLE;
+	TAILQ_INSERT_TAIL(&env_sched_list, e, env_sched_link);
+
+	for (u_int i = 0; i < npages; i++) {
+		p = page_lookup(curenv->env_pgdir, va[i], NULL);
+		try(page_insert(e->env_pgdir, e->env_asid, p, e->env_ipc_dstva + i * PAGE_SIZE,
+				perm));
+	}
+	return 0;
+}
+
 // XXX: kernel does busy waiting here, blocking all envs
 int sys_cgetc(void) {
 	int ch;
@@ -466,6 +607,9 @@ int sys_write_dev(u_int va, u_int pa, u_int len) {
 	if (is_illegal_va_range(va, len)) {
 		return -E_INVAL;
 	}
+	if (is_unfaulted_range(va, len)) {
+		return -E_FAULT;
+	}
 	if (!(len == 1 || len ==2 || len == 4)) {
 		return -E_INVAL;
 	}
@@ -507,6 +651,9 @@ int sys_read_dev(u_int va, u_int pa, u_int len) {
 	if (is_illegal_va_range(va, len)) {
 		return -E_INVAL;
 	}
+	if (is_unfaulted_range(va, len)) {
+		return -E_FAULT;
+	}
 	if (!(len == 1 || len ==2 || len == 4)) {
 		return -E_INVAL;
 	}
@@ -583,6 +730,211 @@ int sys_done_job(int envid) {
 	return 0;
 }
 
+/* Overview:
+ *   Read the kernel log ring into the user buffer 'va' of 'len' bytes, starting at the log
+ *   offset stored at 'poffset'. Lines carry a "<level>" prefix (see 'KLOG_ERR'...'KLOG_DEBUG').
+ *
+ * Post-Condition:
+ *   '*poffset' is advanced past the bytes read. Return the number of bytes read, which is 0
+ *   once the reader has caught up.
+ *   Return -E_INVAL if 'va' or 'poffset' is illegal.
+ *   Return -E_FAULT if they cover a page only the user page fault handler maps.
+ */
+int sys_read_klog(u_int va, u_int len, u_int poffset) {
+	if (is_illegal_va_range(va, len) || is_illegal_va_range(poffset, sizeof(u_int))) {
+		return -E_INVAL;
+	}
+	if (is_unfaulted_range(va, len) || is_unfaulted_range(poffset, sizeof(u_int))) {
+		return -E_FAULT;
+	}
+	return klog_read((char *)va, len, (u_int *)poffset);
+}
+
+/* Overview:
+ *   Store the current value of clock 'clock' (CLOCK_MONOTONIC or CLOCK_ENV_CPUTIME), in
+ *   CP0_COUNT cycles, into the 64-bit user variable at 'va'.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_INVAL if 'clock' is unknown or 'va' is illegal.
+ *   Return -E_FAULT if 'va' is on a page only the user page fault handler maps.
+ */
+int sys_clock_gettime(u_int clock, u_int va) {
+	uint64_t now;
+
+	if (is_illegal_va_range(va, sizeof(uint64_t))) {
+		return -E_INVAL;
+	}
+	if (is_unfaulted_range(va, sizeof(uint64_t))) {
+		return -E_FAULT;
+	}
+	now = kclock_read();
+	if (clock == CLOCK_MONOTONIC) {
+		*(uint64_t *)va = now;
+	} else if (clock == CLOCK_ENV_CPUTIME) {
+		// The system time of the current call is only charged on return, so count it here.
+		*(uint64_t *)va = curenv->env_utime + curenv->env_stime + cputime_pending(now);
+	} else {
+		return -E_INVAL;
+	}
+	return 0;
+}
+
+/* Overview:
+ *   Translate the user word address 'va' of 'curenv' to the physical address that keys the
+ *   waits on it, or the page parked under it.
+ *
+ * Post-Condition:
+ *   Return the physical address, or 0 if 'va' is illegal, unaligned or not mapped.
+ */
+static u_int word_pa(u_int va) {
+	struct Page *p;
+
+	// Words above UTOP are fine too: an env may wait on the read-only 'envs' at UENVS.
+	if ((va & 3) || va < UTEMP || va >= ULIM) {
+		return 0;
+	}
+	if ((p = page_lookup(curenv->env_pgdir, va, NULL)) == NULL) {
+		return 0;
+	}
+	return page2pa(p) + (va & (PAGE_SIZE - 1));
+}
+
+/* Overview:
+ *   Block 'curenv' until the word at 'va' is woken up with 'sys_futex_wake', if it still
+ *   holds 'val'. The check and the sleep are atomic, so a wake-up that comes after the caller
+ *   changed its mind on user level can't be lost. A non-zero 'ticks' bounds the wait.
+ *   The word is matched by its physical address: envs sharing a page meet on it wherever
+ *   they map it.
+ *
+ * Post-Condition:
+ *   Return 0 if woken up, or at once if the word no longer holds 'val'.
+ *   Return -E_TIMEOUT if 'ticks' timer interrupts went by first.
+ *   Return -E_INVAL if 'va' is illegal, unaligned or not mapped.
+ */
+int sys_futex_wait(u_int va, u_int val, u_int ticks) {
+	u_int pa;
+
+	if ((pa = word_pa(va)) == 0) {
+		return -E_INVAL;
+	}
+	if (*(volatile u_int *)va != val) {
+		return 0;
+	}
+	wait_block(&pa, 1, ticks);
+	((struct Trapframe *)KSTACKTOP - 1)->regs[2] = 0;
+	schedule(1);
+}
+
+/* Overview:
+ *   Like 'sys_futex_wait', but on the 'n' words of the 'struct WaitKey' array at 'keys': block
+ *   until any of them is woken up, unless one of them already changed. A key with a zero
+ *   'wk_va' waits for console input, which is checked on every timer interrupt. With no key
+ *   at all, just sleep for 'ticks'.
+ *
+ * Post-Condition:
+ *   Return 0 if woken up, or at once if a word no longer holds its value or console input
+ *   is ready.
+ *   Return -E_TIMEOUT if 'ticks' timer interrupts went by first.
+ *   Return -E_INVAL if 'n' is larger than NWAITKEY, 'keys' is illegal, or one of the words
+ *   is illegal, unaligned or not mapped.
+ *   Return -E_FAULT if 'keys' is on a page only the user page fault handler maps.
+ */
+int sys_futex_waitv(u_int keys, u_int n, u_int ticks) {
+	struct WaitKey *wk = (struct WaitKey *)keys;
+	u_int pa[NWAITKEY];
+
+	if (n > NWAITKEY || is_illegal_va_range(keys, n * sizeof(struct WaitKey))) {
+		return -E_INVAL;
+	}
+	if (is_unfaulted_range(keys, n * sizeof(struct WaitKey))) {
+		return -E_FAULT;
+	}
+	for (u_int i = 0; i < n; i++) {
+		if (wk[i].wk_va == 0) {
+			pa[i] = WAIT_CONS;
+			if (cons_ready()) {
+				return 0;
+			}
+		} else if ((pa[i] = word_pa(wk[i].wk_va)) == 0) {
+			return -E_INVAL;
+		} else if (*(volatile u_int *)wk[i].wk_va != wk[i].wk_val) {
+			return 0;
+		}
+	}
+	wait_block(pa, n, ticks);
+	((struct Trapframe *)KSTACKTOP - 1)->regs[2] = 0;
+	schedule(1);
+}
+
+/* Overview:
+ *   Wake up at most 'n' envs (all of them if 'n' is 0) blocked on the word at 'va'.
+ *
+ * Post-Condition:
+ *   Return the number of envs woken up.
+ *   Return -E_INVAL if 'va' is illegal, unaligned or not mapped.
+ */
+int sys_futex_wake(u_int va, u_int n) {
+	u_int pa;
+
+	if ((pa = word_pa(va)) == 0) {
+		return -E_INVAL;
+	}
+	return wait_wake(pa, n);
+}
+
+/* Overview:
+ *   Park the page mapped at 'srcva' under the word at 'keyva', for an env that shares the
+ *   page of that word to map it later with 'sys_page_unpark'. The caller keeps its mapping.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_INVAL if 'keyva' is illegal, unaligned or not mapped, if 'srcva' is illegal or
+ *   not mapped, or if a page is already parked under 'keyva'.
+ *   Return -E_NO_MEM if there are too many parked pages.
+ */
+int sys_page_park(u_int keyva, u_int srcva) {
+	struct Page *pp;
+	u_int key;
+
+	if ((key = word_pa(keyva)) == 0 || is_illegal_va(srcva)) {
+		return -E_INVAL;
+	}
+	if ((pp = page_lookup(curenv->env_pgdir, srcva, NULL)) == NULL) {
+		return -E_INVAL;
+	}
+	return park_page(key, pp);
+}
+
+/* Overview:
+ *   Map the page parked under the word at 'keyva' at 'dstva' in 'curenv' with 'perm' (unless
+ *   'dstva' is 0), then drop it from the slot unless 'keep' is set.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_NOT_FOUND if no page is parked under 'keyva'.
+ *   Return -E_INVAL if 'keyva' is illegal, unaligned or not mapped, or 'dstva' is illegal.
+ *   Return the original error when underlying calls fail.
+ */
+int sys_page_unpark(u_int keyva, u_int dstva, u_int perm, u_int keep) {
+	struct Page *pp;
+	u_int key;
+
+	if ((key = word_pa(keyva)) == 0 || (dstva != 0 && is_illegal_va(dstva))) {
+		return -E_INVAL;
+	}
+	if ((pp = park_lookup(key)) == NULL) {
+		return -E_NOT_FOUND;
+	}
+	if (dstva != 0) {
+		try(page_insert(curenv->env_pgdir, curenv->env_asid, pp, dstva, perm));
+	}
+	if (!keep) {
+		park_drop(key);
+	}
+	return 0;
+}
+
 void *syscall_table[MAX_SYSNO] = {
     [SYS_putchar] = sys_putchar,
     [SYS_print_cons] = sys_print_cons,
@@ -607,6 +959,16 @@ void *syscall_table[MAX_SYSNO] = {
 	[SYS_print_job] = sys_print_job,
 	[SYS_add_job] = sys_add_job,
 	[SYS_done_job] = sys_done_job,
+	[SYS_read_klog] = sys_read_klog,
+	[SYS_clock_gettime] = sys_clock_gettime,
+	[SYS_ipc_recv_pages] = sys_ipc_recv_pages,
+	[SYS_ipc_try_send_pages] = sys_ipc_try_send_pages,
+	[SYS_set_pgfault_entry] = sys_set_pgfault_entry,
+	[SYS_futex_wait] = sys_futex_wait,
+	[SYS_futex_wake] = sys_futex_wake,
+	[SYS_futex_waitv] = sys_futex_waitv,
+	[SYS_page_park] = sys_page_park,
+	[SYS_page_unpark] = sys_page_unpark,
 };
 
 /* Overview:
@@ -660,7 +1022,6 @@ void do_syscall(struct Trapframe *tf) {
 //    msyscall(SYS_func, envid, value, srcva, perm);
 //}
 
-
 //在kern/syscall.h的enum 的MAX_SYSNO 前面加上 SYS_func
 //kern/syscall_all.c的 void *syscall_table[MAX_SYSNO] 的最后加上 [SYS_func] = sys_func,
 //int sys_func(u_int envid, u_int value, u_int srcva, u_int perm) {
@@ -669,8 +1030,6 @@ void do_syscall(struct Trapframe *tf) {
 
 
 
-
-
 // kern/syscall_all.c
 // extern struct Env envs[NENV]; //注意 extern！！
 // int sys_ipc_try_broadcast(u_int value, u_int srcva, u_int perm) {
@@ -734,7 +1093,6 @@ void do_syscall(struct Trapframe *tf) {
 // 	return 0;
 // }
 
-
 //经过和其他同学的讨论，以及代码对拍，下面这个代码可能可以得100分
 // u_int sys_barrier_wait(u_int* p_barrier_num, u_int* p_barrier_useful) {
 // 	static u_int env_not[100];
@@ -1,3 +1,4 @@
+#include <asm/cp0regdef.h>
 #include <bitops.h>
 #include <env.h>
 #include <pmap.h>
@@ -26,6 +27,10 @@ static void passive_alloc(u_int va, Pde *pgdir, u_int asid) {
 		panic("invalid memory");
 	}
 
+	if (va >= UINFO && va < UENVS) {
+		panic("info zone");
+	}
+
 	if (va >= UENVS && va < UPAGES) {
 		panic("envs zone");
 	}
@@ -65,11 +70,45 @@ void _do_tlb_refill(u_long *pentrylo, u_int va, u_int asid) {
 	pentrylo[1] = ppte[1] >> 6;
 }
 
+/* Overview:
+ *   This is the TLB miss exception handler in kernel.
+ *   A user-mode access to an unmapped page inside the range registered with
+ *   'sys_set_pgfault_entry' is handed to the user handler, in the same way as 'do_tlb_mod' does:
+ *   the context 'tf' is pushed onto UXSTACK and EPC is set to 'env_user_pgfault_entry'. The
+ *   handler maps the page and restores the context, and the access is retried.
+ *   A miss of the kernel itself on such a page can't be handed over, so the syscalls that
+ *   take user buffers reject those pages beforehand (see 'is_unfaulted_range').
+ *   Any other miss is refilled by 'do_tlb_refill', allocating a page if needed.
+ */
+void do_tlb_miss(struct Trapframe *tf) {
+#if !defined(LAB) || LAB >= 4
+	u_int va = tf->cp0_badvaddr;
+
+	if ((tf->cp0_status & STATUS_UM) && curenv->env_user_pgfault_entry &&
+	    va >= curenv->env_pgfault_start && va < curenv->env_pgfault_end &&
+	    page_lookup(cur_pgdir, va, NULL) == NULL) {
+		struct Trapframe tmp_tf = *tf;
+
+		if (tf->regs[29] < USTACKTOP || tf->regs[29] >= UXSTACKTOP) {
+			tf->regs[29] = UXSTACKTOP;
+		}
+		tf->regs[29] -= sizeof(struct Trapframe);
+		*(struct Trapframe *)tf->regs[29] = tmp_tf;
+		tf->regs[4] = tf->regs[29];
+		tf->regs[29] -= sizeof(tf->regs[4]);
+		tf->cp0_epc = curenv->env_user_pgfault_entry;
+		return;
+	}
+#endif
+	do_tlb_refill();
+}
+
 #if !defined(LAB) || LAB >= 4
 /* Overview:
  *   This is the TLB Mod exception handler in kernel.
  *   Our kernel allows user programs to handle TLB Mod exception in user mode, so we copy its
  *   context 'tf' into UXSTACK and modify the EPC to the registered user exception entry.
+ *   A store to a page mapped with PTE_WTRACK is handled here instead, see include/mmu.h.
  *
  * Hints:
  *   'env_user_tlb_mod_entry' is the user space entry registered using
@@ -79,6 +118,14 @@ void _do_tlb_refill(u_long *pentrylo, u_int va, u_int asid) {
  */
 void do_tlb_mod(struct Trapframe *tf) {
 	struct Trapframe tmp_tf = *tf;
+	Pte *wpte;
+
+	// First store to a write-tracked page: make it writable and record that it was written.
+	if (page_lookup(cur_pgdir, tf->cp0_badvaddr, &wpte) && (*wpte & PTE_WTRACK)) {
+		*wpte = (*wpte & ~PTE_WTRACK) | PTE_D | PTE_DIRTY;
+		tlb_invalidate(curenv->env_asid, tf->cp0_badvaddr);
+		return;
+	}
 
 	if (tf->regs[29] < USTACKTOP || tf->regs[29] >= UXSTACKTOP) {
 		tf->regs[29] = UXSTACKTOP;
@@ -0,0 +1,101 @@
+#include <env.h>
+#include <error.h>
+#include <kclock.h>
+#include <machine.h>
+#include <wait.h>
+
+// Envs blocked in 'sys_futex_wait' or 'sys_futex_waitv'. A wait is keyed by the physical
+// address of the word, so that envs sharing the page at different virtual addresses still meet.
+static struct Env_list wait_list;
+static u_int wait_ncons; // waiting envs with a 'WAIT_CONS' key
+
+/* Overview:
+ *   Block 'curenv' on the 'nkeys' words at the physical addresses 'keys' (or console input,
+ *   for 'WAIT_CONS'), for at most 'ticks' timer interrupts (forever if 'ticks' is 0). No key
+ *   at all is a plain sleep. The caller still has to 'schedule'.
+ */
+void wait_block(const u_int *keys, u_int nkeys, u_int ticks) {
+	for (u_int i = 0; i < nkeys; i++) {
+		curenv->env_wait_keys[i] = keys[i];
+		wait_ncons += keys[i] == WAIT_CONS;
+	}
+	curenv->env_wait_nkeys = nkeys;
+	curenv->env_wait_until = ticks ? kclock_ticks + ticks : 0;
+	curenv->env_waiting = 1;
+	LIST_INSERT_HEAD(&wait_list, curenv, env_wait_link);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	TAILQ_REMOVE(&env_sched_list, curenv, env_sched_link);
+}
+
+/* Overview:
+ *   Make the blocked 'e' runnable again, with 'r' as the return value of its wait.
+ */
+static void wait_resume(struct Env *e, int r) {
+	wait_cancel(e);
+	e->env_tf.regs[2] = r;
+	e->env_status = ENV_RUNNABLE;
+	TAILQ_INSERT_TAIL(&env_sched_list, e, env_sched_link);
+}
+
+static int wait_on(struct Env *e, u_int key) {
+	for (u_int i = 0; i < e->env_wait_nkeys; i++) {
+		if (e->env_wait_keys[i] == key) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Overview:
+ *   Wake up at most 'n' envs (all of them if 'n' is 0) blocked on 'key'.
+ *
+ * Post-Condition:
+ *   Return the number of envs woken up.
+ */
+int wait_wake(u_int key, u_int n) {
+	struct Env *e, *next;
+	int woken = 0;
+
+	for (e = LIST_FIRST(&wait_list); e != NULL; e = next) {
+		next = LIST_NEXT(e, env_wait_link);
+		if (wait_on(e, key)) {
+			wait_resume(e, 0);
+			if (++woken == n) {
+				break;
+			}
+		}
+	}
+	return woken;
+}
+
+/* Overview:
+ *   Called on every timer interrupt: wake up the envs waiting for console input if there is
+ *   some, and time out the waits whose deadline has passed.
+ */
+void wait_tick(void) {
+	struct Env *e, *next;
+
+	if (wait_ncons > 0 && cons_ready()) {
+		wait_wake(WAIT_CONS, 0);
+	}
+	for (e = LIST_FIRST(&wait_list); e != NULL; e = next) {
+		next = LIST_NEXT(e, env_wait_link);
+		if (e->env_wait_until != 0 && (int)(kclock_ticks - e->env_wait_until) >= 0) {
+			wait_resume(e, -E_TIMEOUT);
+		}
+	}
+}
+
+/* Overview:
+ *   Take 'e' off the waiting envs, if it is one of them.
+ */
+void wait_cancel(struct Env *e) {
+	if (!e->env_waiting) {
+		return;
+	}
+	LIST_REMOVE(e, env_wait_link);
+	for (u_int i = 0; i < e->env_wait_nkeys; i++) {
+		wait_ncons -= e->env_wait_keys[i] == WAIT_CONS;
+	}
+	e->env_waiting = 0;
+}
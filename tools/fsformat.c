@@ -20,7 +20,7 @@
 typedef struct Super Super;
 typedef struct File File;
 
-#define NBLOCK 1024 // The number of blocks in the disk.
+#define NBLOCK 8192 // The number of blocks in the disk.
 uint32_t nbitblock; // the number of bitmap blocks.
 uint32_t nextbno;   // next availiable block.
 
@@ -34,6 +34,7 @@ enum {
 	BLOCK_DATA = 4,
 	BLOCK_FILE = 5,
 	BLOCK_INDEX = 6,
+	BLOCK_EXTENT = 7,
 };
 
 struct Block {
@@ -51,9 +52,37 @@ void reverse(uint32_t *p) {
 	x[0] = (y >> 24) & 0xFF;
 }
 
+// reverse_file: reverse proper field in a 'File'.
+void reverse_file(struct File *ff) {
+	uint32_t flags = ff->f_flags;
+	int j;
+
+	reverse(&ff->f_size);
+	reverse(&ff->f_type);
+	reverse(&ff->f_flags);
+	if (flags & FILE_INLINE) {
+		return; // 'f_data' is bytes.
+	} else if (flags & FILE_EXTENTS) {
+		reverse(&ff->f_nextent);
+		reverse(&ff->f_extblock);
+		for (j = 0; j < NEXTENT_INLINE; ++j) {
+			reverse(&ff->f_extents[j].fe_fileblk);
+			reverse(&ff->f_extents[j].fe_diskblk);
+			reverse(&ff->f_extents[j].fe_len);
+		}
+	} else {
+		for (j = 0; j < NDIRECT; ++j) {
+			reverse(&ff->f_direct[j]);
+		}
+		reverse(&ff->f_indirect);
+		reverse(&ff->f_indirect2);
+		reverse(&ff->f_indirect3);
+	}
+}
+
 // reverse_block: reverse proper filed in a block.
 void reverse_block(struct Block *b) {
-	int i, j;
+	int i;
 	struct Super *s;
 	struct File *f, *ff;
 	uint32_t *u;
@@ -67,13 +96,7 @@ void reverse_block(struct Block *b) {
 		reverse(&s->s_magic);
 		reverse(&s->s_nblocks);
 
-		ff = &s->s_root;
-		reverse(&ff->f_size);
-		reverse(&ff->f_type);
-		for (i = 0; i < NDIRECT; ++i) {
-			reverse(&ff->f_direct[i]);
-		}
-		reverse(&ff->f_indirect);
+		reverse_file(&s->s_root);
 		break;
 	case BLOCK_FILE:
 		f = (struct File *)b->data;
@@ -82,16 +105,12 @@ void reverse_block(struct Block *b) {
 			if (ff->f_name[0] == 0) {
 				break;
 			} else {
-				reverse(&ff->f_size);
-				reverse(&ff->f_type);
-				for (j = 0; j < NDIRECT; ++j) {
-					reverse(&ff->f_direct[j]);
-				}
-				reverse(&ff->f_indirect);
+				reverse_file(ff);
 			}
 		}
 		break;
 	case BLOCK_INDEX:
+	case BLOCK_EXTENT:
 	case BLOCK_BMAP:
 		u = (uint32_t *)b->data;
 		for (i = 0; i < BLOCK_SIZE / 4; ++i) {
@@ -169,19 +188,69 @@ void finish_fs(char *name) {
 	close(fd);
 }
 
-// Save block link.
-void save_block_link(struct File *f, int nblk, int bno) {
-	assert(nblk < NINDIRECT); // if not, file is too large !
+// Get the slot of block link 'nblk' in file 'f', creating the index blocks on the way.
+uint32_t *block_link(struct File *f, uint32_t nblk) {
+	uint32_t *p, span;
 
 	if (nblk < NDIRECT) {
-		f->f_direct[nblk] = bno;
+		return &f->f_direct[nblk];
+	}
+	if (nblk < NINDIRECT) {
+		p = &f->f_indirect;
+		span = 1;
+	} else if ((nblk -= NINDIRECT) < NINDIRECT2) {
+		p = &f->f_indirect2;
+		span = NINDIRECT;
 	} else {
-		if (f->f_indirect == 0) {
+		nblk -= NINDIRECT2;
+		assert(nblk < NINDIRECT3); // if not, file is too large !
+		p = &f->f_indirect3;
+		span = NINDIRECT2;
+	}
+	for (; span > 0; span /= NINDIRECT) {
+		if (*p == 0) {
 			// create new indirect block.
-			f->f_indirect = next_block(BLOCK_INDEX);
+			*p = next_block(BLOCK_INDEX);
+		}
+		p = (uint32_t *)(disk[*p].data) + nblk / span % NINDIRECT;
+	}
+	return p;
+}
+
+// Save block link.
+void save_block_link(struct File *f, int nblk, int bno) {
+	*block_link(f, nblk) = bno;
+}
+
+// Save block 'nblk' of the extent-mapped file 'f': grow its last extent if the block follows
+// it, start a new extent otherwise.
+void save_block_extent(struct File *f, uint32_t nblk, uint32_t bno) {
+	struct FileExtent *e = NULL;
+
+	if (f->f_nextent > 0) {
+		uint32_t i = f->f_nextent - 1;
+		e = i < NEXTENT_INLINE ? &f->f_extents[i]
+				       : (struct FileExtent *)disk[f->f_extblock].data + i - NEXTENT_INLINE;
+	}
+	if (e && e->fe_fileblk + e->fe_len == nblk && e->fe_diskblk + e->fe_len == bno) {
+		e->fe_len++;
+		return;
+	}
+
+	assert(f->f_nextent < NEXTENT); // if not, file is too fragmented !
+	if (f->f_nextent < NEXTENT_INLINE) {
+		e = &f->f_extents[f->f_nextent];
+	} else {
+		if (f->f_extblock == 0) {
+			// create new extent block.
+			f->f_extblock = next_block(BLOCK_EXTENT);
 		}
-		((uint32_t *)(disk[f->f_indirect].data))[nblk] = bno;
+		e = (struct FileExtent *)disk[f->f_extblock].data + f->f_nextent - NEXTENT_INLINE;
 	}
+	e->fe_fileblk = nblk;
+	e->fe_diskblk = bno;
+	e->fe_len = 1;
+	f->f_nextent++;
 }
 
 // Make new block contains link to files in a directory.
@@ -215,11 +284,7 @@ struct File *create_file(struct File *dirf) {
 		// directly from 'f_direct'. Otherwise, access the indirect block on 'disk' and get
 		// the 'bno' at the index.
 		/* Exercise 5.5: Your code here. (1/3) */
-		if (i < NDIRECT) {
-			bno = dirf -> f_direct[i];
-		} else {
-			bno = *((int *)disk[dirf->f_indirect].data + i);
-		}
+		bno = *block_link(dirf, i);
 		// Get the directory block using the block number.
 		struct File *blk = (struct File *)(disk[bno].data);
 
@@ -268,8 +333,18 @@ void write_file(struct File *dirf, const char *path) {
 
 	// Start reading file.
 	lseek(fd, 0, SEEK_SET);
+	if (target->f_size <= FILE_INLINE_MAX) {
+		// Tiny files are kept in their 'File'.
+		target->f_flags = FILE_INLINE;
+		r = read(fd, target->f_data, target->f_size);
+		assert(r == target->f_size);
+		close(fd);
+		return;
+	}
+	// Regular files are written out in one go, so they map to a single extent.
+	target->f_flags = FILE_EXTENTS;
 	while ((r = read(fd, disk[nextbno].data, n)) > 0) {
-		save_block_link(target, iblk++, next_block(BLOCK_DATA));
+		save_block_extent(target, iblk++, next_block(BLOCK_DATA));
 	}
 	close(fd); // Close file descriptor.
 }
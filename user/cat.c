@@ -1,6 +1,6 @@
 #include <lib.h>
 
-char buf[8192];
+char buf[8192] __attribute__((aligned(PAGE_SIZE))); // whole pages go through pipes uncopied
 
 void cat(int f, char *s) {
 	long n;
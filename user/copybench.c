@@ -0,0 +1,108 @@
+#include <lib.h>
+
+// File copy throughput: copy a file with a read/write loop through a user buffer, then with
+// 'copy_file_range', which the file server serves in its block cache, and then into a pipe
+// with 'sendfile' against a read/write loop.
+
+char buf[BLOCK_SIZE];
+
+static u_int cycles_since(uint64_t start) {
+	uint64_t now;
+
+	syscall_clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u_int)(now - start);
+}
+
+static int open_pair(char *path, char *dst, int *fin, int *fout) {
+	if ((*fin = open(path, O_RDONLY)) < 0) {
+		printf("copybench: open %s: %d\n", path, *fin);
+		return *fin;
+	}
+	if ((*fout = open(dst, O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+		printf("copybench: open %s: %d\n", dst, *fout);
+		close(*fin);
+		return *fout;
+	}
+	return 0;
+}
+
+// Drain the read end of a pipe until the writer closes it.
+static void drain(int p) {
+	while (read(p, buf, sizeof buf) > 0) {
+	}
+	exit(0);
+}
+
+static int pipe_copy(char *path, int use_sendfile) {
+	int p[2], fin, n, r;
+	u_int total = 0;
+
+	if ((fin = open(path, O_RDONLY)) < 0) {
+		return fin;
+	}
+	try(pipe(p));
+	if ((r = fork()) < 0) {
+		return r;
+	}
+	if (r == 0) {
+		close(p[1]);
+		drain(p[0]);
+	}
+	close(p[0]);
+	for (;;) {
+		if (use_sendfile) {
+			n = sendfile(p[1], fin, BLOCK_SIZE);
+		} else if ((n = read(fin, buf, sizeof buf)) > 0) {
+			n = write(p[1], buf, n);
+		}
+		if (n <= 0) {
+			break;
+		}
+		total += n;
+	}
+	close(p[1]);
+	close(fin);
+	wait(r);
+	return total;
+}
+
+int main(int argc, char **argv) {
+	char *path = argc > 1 ? argv[1] : "/sh.b";
+	uint64_t start;
+	u_int total = 0;
+	int fin, fout, n;
+
+	// read/write loop
+	try(open_pair(path, "/copybench.rw", &fin, &fout));
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((n = read(fin, buf, sizeof buf)) > 0) {
+		write(fout, buf, n);
+		total += n;
+	}
+	close(fout);
+	close(fin);
+	printf("%s: %u bytes, read/write %u cycles\n", path, total, cycles_since(start));
+
+	// copy_file_range
+	total = 0;
+	try(open_pair(path, "/copybench.cfr", &fin, &fout));
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((n = copy_file_range(fin, fout, MAXFILESIZE)) > 0) {
+		total += n;
+	}
+	close(fout);
+	close(fin);
+	printf("%s: %u bytes, copy_file_range %u cycles\n", path, total, cycles_since(start));
+
+	remove("/copybench.rw");
+	remove("/copybench.cfr");
+
+	// into a pipe
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	n = pipe_copy(path, 0);
+	printf("%s: %d bytes to a pipe, read/write %u cycles\n", path, n, cycles_since(start));
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	n = pipe_copy(path, 1);
+	printf("%s: %d bytes to a pipe, sendfile %u cycles\n", path, n, cycles_since(start));
+	return 0;
+}
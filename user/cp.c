@@ -0,0 +1,29 @@
+#include <lib.h>
+
+// Copy a file. The file server copies the blocks itself (see 'copy_file_range'), so the data
+// never goes through this env.
+
+int main(int argc, char **argv) {
+	int src, dst, r;
+
+	if (argc != 3) {
+		fprintf(1, "usage: cp <source> <dest>\n");
+		return 1;
+	}
+	if ((src = open(argv[1], O_RDONLY)) < 0) {
+		fprintf(1, "cp: cannot stat '%s': No such file or directory\n", argv[1]);
+		return 1;
+	}
+	if ((dst = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+		fprintf(1, "cp: cannot create regular file '%s': %d\n", argv[2], dst);
+		return 1;
+	}
+	while ((r = copy_file_range(src, dst, MAXFILESIZE)) > 0) {
+	}
+	if (r < 0) {
+		fprintf(1, "cp: error copying '%s' to '%s': %d\n", argv[1], argv[2], r);
+	}
+	close(src);
+	close(dst);
+	return r < 0;
+}
@@ -0,0 +1,55 @@
+#include <lib.h>
+
+char buf[1024];
+
+void usage(void) {
+	printf("usage: dmesg [-l level]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	u_int offset = 0;
+	int maxlevel = 9, level = 0, bol = 1, prefix = 0;
+	char *arg;
+	int n;
+
+	ARGBEGIN {
+	case 'l':
+		if ((arg = ARGF()) == 0) {
+			usage();
+		}
+		maxlevel = arg[0] - '0';
+		break;
+	default:
+		usage();
+	}
+	ARGEND
+
+	// Each line in the log starts with "<level>"; strip it and drop lines above 'maxlevel'.
+	while ((n = syscall_read_klog(buf, sizeof buf, &offset)) > 0) {
+		for (int i = 0; i < n; i++) {
+			char c = buf[i];
+			if (bol && c == '<') {
+				prefix = 1;
+				bol = 0;
+				continue;
+			}
+			if (prefix) {
+				if (c == '>') {
+					prefix = 0;
+				} else {
+					level = c - '0';
+				}
+				continue;
+			}
+			bol = c == '\n';
+			if (level <= maxlevel) {
+				putchar(c);
+			}
+		}
+	}
+	if (n < 0) {
+		user_panic("syscall_read_klog: %d", n);
+	}
+	return 0;
+}
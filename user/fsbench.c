@@ -0,0 +1,73 @@
+#include <lib.h>
+
+// Concurrent file server clients: the first one reads a large file, whose blocks mostly miss
+// the block cache, while the others keep reading a small file that stays cached. Each client
+// reports how long its rounds took, so the hot clients show whether they are held up by the
+// misses of the cold one.
+
+#define ROUNDS 20
+
+char buf[BLOCK_SIZE];
+
+static u_int cycles_since(uint64_t start) {
+	uint64_t now;
+
+	syscall_clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u_int)(now - start);
+}
+
+static void client(int id, char *path, int rounds) {
+	uint64_t start;
+	u_int total = 0;
+	int fd, n;
+
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < rounds; i++) {
+		if ((fd = open(path, O_RDONLY)) < 0) {
+			printf("fsbench: open %s: %d\n", path, fd);
+			exit(1);
+		}
+		while ((n = read(fd, buf, sizeof buf)) > 0) {
+			total += n;
+		}
+		close(fd);
+	}
+	printf("client %d: %s, %u bytes in %u cycles\n", id, path, total, cycles_since(start));
+	exit(0);
+}
+
+int main(int argc, char **argv) {
+	int nclients = 4;
+	char *cold = argc > 2 ? argv[2] : "/sh.b";
+	char *hot = argc > 3 ? argv[3] : "/motd";
+	u_int clients[16];
+	uint64_t start;
+	int r;
+
+	if (argc > 1) {
+		nclients = 0;
+		for (char *p = argv[1]; *p >= '0' && *p <= '9'; p++) {
+			nclients = nclients * 10 + *p - '0';
+		}
+	}
+	if (nclients < 1 || nclients > 16) {
+		printf("usage: fsbench [nclients (1-16)] [cold file] [hot file]\n");
+		return 1;
+	}
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < nclients; i++) {
+		if ((r = fork()) < 0) {
+			printf("fsbench: fork: %d\n", r);
+			return 1;
+		}
+		if (r == 0) {
+			client(i, i == 0 ? cold : hot, i == 0 ? 1 : ROUNDS);
+		}
+		clients[i] = r;
+	}
+	for (int i = 0; i < nclients; i++) {
+		wait(clients[i]);
+	}
+	printf("%d clients done in %u cycles\n", nclients, cycles_since(start));
+	return 0;
+}
@@ -0,0 +1,15 @@
+#include <lib.h>
+
+int main(int argc, char **argv) {
+	struct BlockCacheStat st;
+	int r;
+
+	if ((r = fsipc_cache_stat(&st)) < 0) {
+		printf("fsstat: %d\n", r);
+		return 1;
+	}
+	printf("block cache: %u/%u pages\n", st.bc_npages, st.bc_budget);
+	printf("hits %u misses %u evictions %u writebacks %u readahead %u\n", st.bc_hits,
+	       st.bc_misses, st.bc_evictions, st.bc_writebacks, st.bc_readahead);
+	return 0;
+}
@@ -1,5 +1,7 @@
 #include <lib.h>
 
 int main() {
+	// The file server writes back lazily; don't lose what it still holds.
+	sync();
 	user_halt("halt mos!");
 }
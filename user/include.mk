@@ -17,7 +17,8 @@ ifeq ($(call lab-ge,5), true)
 			file.o \
 			fsipc.o \
 			console.o \
-			fprintf.o
+			fprintf.o \
+			stdio.o
 
 endif
 
@@ -36,16 +37,28 @@ ifeq ($(call lab-ge,6), true)
 			cat.b \
 			touch.b \
 			mkdir.b \
+			mkfifo.b \
 			rm.b \
 			sleep.b \
 			true.b \
 			false.b \
 			testpipe.b \
 			testpiperace.b \
+			testpoll.b \
+			testfifo.b \
+			testbigfile.b \
 			testptelibrary.b \
 			testarg.b \
 			testbss.b \
 			testfdsharing.b \
+			dmesg.b \
+			time.b \
+			fsstat.b \
+			readbench.b \
+			fsbench.b \
+			cp.b \
+			copybench.b \
+			pipebench.b \
 			pingpong.b \
 			init.b
 endif
@@ -1,21 +1,27 @@
 #ifndef _USER_FD_H_
 #define _USER_FD_H_ 1
 
+#include <env.h>
 #include <fs.h>
 
 #define debug 0
 
 #define MAXFD 32
-#define FILEBASE 0x60000000
+#define FILEBASE 0x5c000000
 #define FDTABLE (FILEBASE - PDMAP)
 
+// Each fd has a window of FDDATASIZE bytes (a multiple of PDMAP) to map its data.
+#define FDDATASIZE MAXFILESIZE
+
 #define INDEX2FD(i) (FDTABLE + (i)*PTMAP)
-#define INDEX2DATA(i) (FILEBASE + (i)*PDMAP)
+#define INDEX2DATA(i) (FILEBASE + (i)*FDDATASIZE)
+#define DATA2INDEX(va) (((u_long)(va)-FILEBASE) / FDDATASIZE)
 
 // pre-declare for forward references
 struct Fd;
 struct Stat;
 struct Dev;
+struct Pollwait;
 
 // Device struct:
 // It is used to read and write data from corresponding device.
@@ -29,6 +35,28 @@ struct Dev {
 	int (*dev_close)(struct Fd *);
 	int (*dev_stat)(struct Fd *, struct Stat *);
 	int (*dev_seek)(struct Fd *, u_int);
+	// Return the events of 'poll' ready on the fd among those asked for. If none is, register
+	// the words to block on with 'poll_wait' (unless the 'Pollwait' is NULL).
+	int (*dev_poll)(struct Fd *, int, struct Pollwait *);
+};
+
+// Events of 'poll'.
+#define POLLIN 0x1    // there is data to read
+#define POLLOUT 0x4   // there is room to write
+#define POLLHUP 0x10  // the other end is closed (reported even if not asked for)
+#define POLLNVAL 0x20 // not an open file descriptor (reported even if not asked for)
+
+struct pollfd {
+	int fd;	       // file descriptor, ignored if negative
+	short events;  // events asked for
+	short revents; // events ready
+};
+
+// The words 'poll' blocks on, collected from the devices that are not ready.
+struct Pollwait {
+	struct WaitKey pw_keys[NWAITKEY];
+	u_int pw_nkeys;
+	u_int pw_full; // some words didn't fit
 };
 
 // file descriptor
@@ -59,6 +87,7 @@ void *fd2data(struct Fd *);
 int fd2num(struct Fd *);
 int dev_lookup(int dev_id, struct Dev **dev);
 int num2fd(int fd);
+void poll_wait(struct Pollwait *pw, u_int *va, u_int val);
 extern struct Dev devcons;
 extern struct Dev devfile;
 extern struct Dev devpipe;
@@ -19,26 +19,84 @@
 #define NDIRECT 10
 #define NINDIRECT (BLOCK_SIZE / 4)
 
-#define MAXFILESIZE (NINDIRECT * BLOCK_SIZE)
+// Blocks [NDIRECT, NINDIRECT) of a file are reached through 'f_indirect', the next NINDIRECT2
+// through the double indirect block 'f_indirect2', and the next NINDIRECT3 through the triple
+// indirect block 'f_indirect3'.
+#define NINDIRECT2 (NINDIRECT * NINDIRECT)
+#define NINDIRECT3 (NINDIRECT2 * NINDIRECT)
+
+// The disk format goes much further, but a client maps a whole file into the data window of
+// its fd (see INDEX2DATA), which is this large.
+#define MAXFILESIZE (4 * NINDIRECT * BLOCK_SIZE)
 
 #define FILE_STRUCT_SIZE 256
 
+// A run of 'fe_len' blocks of an extent-mapped file, starting at file block 'fe_fileblk' and
+// disk block 'fe_diskblk'.
+struct FileExtent {
+	uint32_t fe_fileblk;
+	uint32_t fe_diskblk;
+	uint32_t fe_len;
+} __attribute__((aligned(4), packed));
+
+// An extent-mapped file (FILE_EXTENTS set in 'f_flags') has no block pointers. Its blocks are
+// described by 'f_nextent' runs sorted by file block: the first NEXTENT_INLINE are kept in the
+// 'File', the rest in the extent block 'f_extblock'.
+#define NEXTENT_INLINE 8
+#define NEXTENT (NEXTENT_INLINE + BLOCK_SIZE / sizeof(struct FileExtent))
+
+// A regular file of at most FILE_INLINE_MAX bytes may keep its data in the 'File' itself
+// (FILE_INLINE set in 'f_flags'), in place of its block map.
+#define FILE_INLINE_MAX (8 + NEXTENT_INLINE * 12)
+
 struct File {
 	char f_name[MAXNAMELEN]; // filename
 	uint32_t f_size;	 // file size in bytes
 	uint32_t f_type;	 // file type
-	uint32_t f_direct[NDIRECT];
-	uint32_t f_indirect;
-
-	struct File *f_dir; // the pointer to the dir where this file is in, valid only in memory.
-	char f_pad[FILE_STRUCT_SIZE - MAXNAMELEN - (3 + NDIRECT) * 4 - sizeof(void *)];
+	uint32_t f_flags;	 // FILE_* flags
+	union {
+		// Block pointers.
+		struct {
+			uint32_t f_direct[NDIRECT];
+			uint32_t f_indirect;
+			uint32_t f_indirect2; // double indirect block
+			uint32_t f_indirect3; // triple indirect block
+		};
+		// FILE_EXTENTS
+		struct {
+			uint32_t f_nextent;  // number of extents
+			uint32_t f_extblock; // extents past the first NEXTENT_INLINE
+			struct FileExtent f_extents[NEXTENT_INLINE];
+		};
+		// FILE_INLINE
+		char f_data[FILE_INLINE_MAX];
+	};
+
+	// The pointer to the dir where this file is in, valid only in memory. It comes last so
+	// that the on-disk fields are at the same offsets in the (64-bit) fsformat tool.
+	struct File *f_dir;
+	char f_pad[FILE_STRUCT_SIZE - MAXNAMELEN - 3 * 4 - FILE_INLINE_MAX - sizeof(void *)];
 } __attribute__((aligned(4), packed));
 
+// Fails to compile, in fsformat as on the target, if a field of a different size on the two
+// comes before 'f_dir' (the on-disk fields would then be misread), or if a File doesn't take
+// FILE_STRUCT_SIZE bytes.
+typedef char file_layout_check[__builtin_offsetof(struct File, f_dir) ==
+				       MAXNAMELEN + 3 * 4 + FILE_INLINE_MAX &&
+			       sizeof(struct File) == FILE_STRUCT_SIZE
+			   ? 1
+			   : -1];
+
 #define FILE2BLK (BLOCK_SIZE / sizeof(struct File))
 
 // File types
 #define FTYPE_REG 0 // Regular file
 #define FTYPE_DIR 1 // Directory
+#define FTYPE_FIFO 2 // Named pipe, whose data is never written to the disk
+
+// File flags
+#define FILE_EXTENTS 0x1 // blocks are mapped by extents instead of block pointers
+#define FILE_INLINE 0x2	 // data is kept in 'f_data' instead of blocks
 
 // File system super-block (both in-memory and on-disk)
 
@@ -50,4 +108,15 @@ struct Super {
 	struct File s_root; // Root directory node
 };
 
+// Block cache counters of the file system server (see FSREQ_CACHE_STAT)
+struct BlockCacheStat {
+	uint32_t bc_hits;	// 'read_block' found the block in memory
+	uint32_t bc_misses;	// 'read_block' had to read the block off disk
+	uint32_t bc_evictions;	// blocks dropped from memory to stay within the budget
+	uint32_t bc_writebacks; // dirty blocks written back on eviction
+	uint32_t bc_readahead;	// blocks read ahead of sequential readers
+	uint32_t bc_npages;	// pages currently used by the cache
+	uint32_t bc_budget;	// maximum number of pages the cache may use
+};
+
 #endif // _FS_H_
@@ -2,6 +2,7 @@
 #define _FSREQ_H_
 
 #include <fs.h>
+#include <mmu.h>
 #include <types.h>
 
 // Definitions for requests from clients to file system
@@ -15,6 +16,15 @@ enum {
 	FSREQ_REMOVE,
 	FSREQ_SYNC,
 	FSREQ_CREATE,
+	FSREQ_CACHE_STAT,
+	FSREQ_FSYNC,
+	FSREQ_FLUSH,
+	FSREQ_MAP_RANGE,
+	FSREQ_DIRTY_RANGE,
+	FSREQ_COPY,
+	FSREQ_FIFO,
+	FSREQ_RING, // register the ring page of the client, sent as the request page
+	FSREQ_KICK, // no page: the ring of the client has requests for an idle server
 	MAX_FSREQNO,
 };
 
@@ -28,6 +38,13 @@ struct Fsreq_map {
 	u_int req_offset;
 };
 
+// Map 'req_npages' (at most IPC_MAXPAGES) consecutive blocks starting at 'req_offset'.
+struct Fsreq_map_range {
+	int req_fileid;
+	u_int req_offset;
+	u_int req_npages;
+};
+
 struct Fsreq_set_size {
 	int req_fileid;
 	u_int req_size;
@@ -42,6 +59,48 @@ struct Fsreq_dirty {
 	u_int req_offset;
 };
 
+struct Fsreq_range {
+	u_int offset; // byte offset of the first page
+	u_int npages;
+};
+
+// Trailer at the end of every request page. When 'req_tag' is set, the server stores the
+// result in 'req_result' and replies with the tag as the IPC value instead, so that a client
+// with several requests in flight can match the replies, which may come in any order.
+struct Fsreq_tag {
+	u_int req_tag;
+	int req_result;
+};
+
+#define FSREQ_TAG(req)                                                                      \
+	((struct Fsreq_tag *)(ROUNDDOWN((u_int)(req), BLOCK_SIZE) + BLOCK_SIZE -           \
+			      sizeof(struct Fsreq_tag)))
+
+#define FSREQ_MAXRANGE                                                                      \
+	((BLOCK_SIZE - 2 * sizeof(u_int) - sizeof(struct Fsreq_tag)) / sizeof(struct Fsreq_range))
+
+// Mark the pages of up to FSREQ_MAXRANGE ranges of a file dirty.
+struct Fsreq_dirty_range {
+	int req_fileid;
+	u_int req_nrange;
+	struct Fsreq_range req_range[FSREQ_MAXRANGE];
+};
+
+// Copy 'req_len' bytes of the file 'req_src_fileid' from 'req_src_offset' on to the file
+// 'req_fileid' at 'req_offset', which must be large enough already.
+struct Fsreq_copy {
+	int req_fileid;
+	u_int req_offset;
+	int req_src_fileid;
+	u_int req_src_offset;
+	u_int req_len;
+};
+
+// Map the page shared by the ends of the named pipe open as 'req_fileid'.
+struct Fsreq_fifo {
+	int req_fileid;
+};
+
 struct Fsreq_remove {
 	char req_path[MAXPATHLEN];
 };
@@ -51,4 +110,55 @@ struct Fsreq_create {
 	int f_type;
 };
 
+struct Fsreq_fsync {
+	int req_fileid;
+};
+
+struct Fsreq_cache_stat {
+	struct BlockCacheStat req_stat; // filled in by the server
+};
+
+// Requests a client may have in flight at once.
+#define FSIPC_NSLOT 8
+
+// Requests that may be sent through the ring of a client: they carry no pages either way.
+#define FSRING_TYPES                                                                        \
+	(1 << FSREQ_SET_SIZE | 1 << FSREQ_CLOSE | 1 << FSREQ_DIRTY | 1 << FSREQ_SYNC |          \
+	 1 << FSREQ_CACHE_STAT | 1 << FSREQ_FSYNC | 1 << FSREQ_DIRTY_RANGE | 1 << FSREQ_COPY)
+
+#define FSRING_REQSIZE 240
+
+// IPC value of the message by which the server wakes a client up (tags are never 0).
+#define FSRING_WAKE 0
+
+// A request in the ring, in the entry of its client slot. Its data is copied to 'sqe_req',
+// and so is the answer the server leaves there.
+struct Fsring_sqe {
+	u_int sqe_tag;
+	u_int sqe_type;
+	u_char sqe_req[FSRING_REQSIZE];
+};
+
+struct Fsring_cqe {
+	u_int cqe_tag;
+	int cqe_result;
+};
+
+// The page a client shares with the file server for good. The client queues requests in
+// 'r_sq' and the server queues their completions in 'r_cq', so they cost no page mapping.
+// Each side sleeps in 'ipc_recv' only after saying so, and is woken up by the other side
+// with a message only then: the server sets 'r_sidle' before it waits for a request, the
+// client sets 'r_cwait' before it waits for a reply. The waker clears the flag.
+struct Fsring {
+	u_int r_sq[FSIPC_NSLOT]; // slots of the requests submitted
+	u_int r_sq_head;	 // advanced by the server
+	u_int r_sq_tail;	 // advanced by the client
+	struct Fsring_cqe r_cq[FSIPC_NSLOT];
+	u_int r_cq_head; // advanced by the client
+	u_int r_cq_tail; // advanced by the server
+	u_int r_sidle;
+	u_int r_cwait;
+	struct Fsring_sqe r_sqe[FSIPC_NSLOT];
+};
+
 #endif
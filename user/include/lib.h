@@ -3,6 +3,7 @@
 #include <args.h>
 #include <env.h>
 #include <fd.h>
+#include <kclock.h>
 #include <mmu.h>
 #include <pmap.h>
 #include <syscall.h>
@@ -12,6 +13,7 @@
 #define vpd ((const volatile Pde *)(UVPT + (PDX(UVPT) << PGSHIFT)))
 #define envs ((const volatile struct Env *)UENVS)
 #define pages ((const volatile struct Page *)UPAGES)
+#define uinfo ((const volatile struct EnvInfo *)UINFO)
 
 
 // libos
@@ -43,6 +45,7 @@ void _user_halt(const char *, int, const char *, ...) __attribute__((noreturn));
 int spawn(char *prog, char **argv);
 int spawnl(char *prot, char *args, ...);
 int fork(void);
+int cow_init(void);
 
 /// syscalls
 extern int msyscall(int, ...);
@@ -53,6 +56,8 @@ u_int syscall_getenvid(void);
 void syscall_yield(void);
 int syscall_env_destroy(u_int envid);
 int syscall_set_tlb_mod_entry(u_int envid, void (*func)(struct Trapframe *));
+int syscall_set_pgfault_entry(u_int envid, void (*func)(struct Trapframe *), u_int start,
+			      u_int end);
 int syscall_mem_alloc(u_int envid, void *va, u_int perm);
 int syscall_mem_map(u_int srcid, void *srcva, u_int dstid, void *dstva, u_int perm);
 int syscall_mem_unmap(u_int envid, void *va);
@@ -75,10 +80,22 @@ int syscall_kill_job(int killId);
 int syscall_print_job();
 int syscall_add_job(u_int envid, char * cmd);
 int syscall_done_job(u_int envid);
+int syscall_read_klog(void *buf, u_int len, u_int *offset);
+int syscall_clock_gettime(u_int clock, uint64_t *time);
+int syscall_ipc_recv_pages(void *dstva, u_int npages);
+int syscall_ipc_try_send_pages(u_int envid, u_int value, void *const *srcvas, u_int npages,
+			       u_int perm);
+int syscall_futex_wait(u_int *va, u_int val, u_int ticks);
+int syscall_futex_wake(u_int *va, u_int n);
+int syscall_futex_waitv(struct WaitKey *keys, u_int n, u_int ticks);
+int syscall_page_park(u_int *key, void *srcva);
+int syscall_page_unpark(u_int *key, void *dstva, u_int perm, u_int keep);
 
 // ipc.c
 void ipc_send(u_int whom, u_int val, const void *srcva, u_int perm);
 u_int ipc_recv(u_int *whom, void *dstva, u_int *perm);
+void ipc_send_pages(u_int whom, u_int val, void *const *srcvas, u_int npages, u_int perm);
+u_int ipc_recv_pages(u_int *whom, void *dstva, u_int *npages, u_int *perm);
 
 // wait.c
 void wait(u_int envid);
@@ -90,6 +107,7 @@ int iscons(int fdnum);
 // pipe.c
 int pipe(int pfd[2]);
 int pipe_is_closed(int fdnum);
+int fifo_open(struct Fd *fd, u_int fileid, int mode);
 
 // pageref.c
 int pageref(void *);
@@ -98,16 +116,68 @@ int pageref(void *);
 int fprintf(int fd, const char *fmt, ...);
 int printf(const char *fmt, ...);
 
+// stdio.c
+#define BUFSIZ 1024
+#define FOPEN_MAX 8
+#define EOF (-1)
+
+// Buffering modes of a stream.
+#define _IOFBF 0 // fully buffered
+#define _IOLBF 1 // line buffered
+#define _IONBF 2 // unbuffered
+
+typedef struct {
+	int fd;		   // underlying file descriptor
+	int mode;	   // buffering mode
+	int flags;	   // STREAM_* flags, see stdio.c
+	u_int pos;	   // bytes of pending output, or next byte of read-ahead
+	u_int len;	   // bytes of read-ahead in 'buf'
+	char buf[BUFSIZ]; // stream buffer
+} FILE;
+
+extern FILE __iob[FOPEN_MAX];
+#define stdin (&__iob[0])
+#define stdout (&__iob[1])
+#define stderr (&__iob[2])
+
+FILE *fdopen(int fd, const char *mode);
+FILE *stream_lookup(int fd);
+void stream_close(int fd);
+int fclose(FILE *fp);
+int setvbuf(FILE *fp, int mode);
+int fflush(FILE *fp);
+int stream_write(FILE *fp, const char *s, u_int n);
+int fputc(int c, FILE *fp);
+int putchar(int c);
+int fputs(const char *s, FILE *fp);
+int fgetc(FILE *fp);
+int getchar(void);
+char *fgets(char *s, int n, FILE *fp);
+int feof(FILE *fp);
+int ferror(FILE *fp);
+#define putc(c, fp) fputc(c, fp)
+#define getc(fp) fgetc(fp)
+
 // fsipc.c
 int fsipc_open(const char *, u_int, struct Fd *);
 int fsipc_map(u_int, u_int, void *);
+int fsipc_map_range(u_int, u_int, u_int, void *);
 int fsipc_set_size(u_int, u_int);
 int fsipc_close(u_int);
 int fsipc_dirty(u_int, u_int);
+struct Fsreq_range;
+int fsipc_dirty_range(u_int fileid, const struct Fsreq_range *ranges, u_int nrange);
+int fsipc_dirty_range_async(u_int fileid, const struct Fsreq_range *ranges, u_int nrange);
+int fsipc_wait(int tag, u_int *npages, u_int *perm);
 int fsipc_remove(const char *);
 int fsipc_sync(void);
 int fsipc_incref(u_int);
 int fsipc_create(const char* path, int f_type);
+int fsipc_cache_stat(struct BlockCacheStat *stat);
+int fsipc_fsync(u_int fileid);
+int fsipc_copy(u_int fileid, u_int offset, u_int src_fileid, u_int src_offset, u_int len);
+int fsipc_fifo(u_int fileid, void *dstva);
+int fsipc_set_fault(int infault);
 
 // fd.c
 int close(int fd);
@@ -119,14 +189,20 @@ int readn(int fd, void *buf, u_int nbytes);
 int dup(int oldfd, int newfd);
 int fstat(int fdnum, struct Stat *stat);
 int stat(const char *path, struct Stat *);
+int poll(struct pollfd *fds, u_int n, int timeout);
 
 // file.c
+int file_fault_init(u_int envid);
 int open(const char *path, int mode);
 int read_map(int fd, u_int offset, void **blk);
 int remove(const char *path);
 int ftruncate(int fd, u_int size);
 int sync(void);
+int fsync(int fd);
 int create(const char *path, int f_type);
+int mkfifo(const char *path);
+int copy_file_range(int fd_in, int fd_out, u_int len);
+int sendfile(int fd_out, int fd_in, u_int len);
 
 #define user_assert(x)                                                                             \
 	do {                                                                                       \
@@ -141,6 +217,7 @@ int create(const char *path, int f_type);
 #define O_ACCMODE 0x0003 /* mask for above modes */
 #define O_CREAT 0x0100	 /* create if nonexistent */
 #define O_TRUNC 0x0200	 /* truncate to zero length */
+#define O_STAT 0x1000	 /* only look the file up: a named pipe is not connected */
 
 // Unimplemented open modes
 #define O_EXCL 0x0400  /* error if already exists */
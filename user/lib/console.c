@@ -5,6 +5,7 @@ static int cons_read(struct Fd *, void *, u_int, u_int);
 static int cons_write(struct Fd *, const void *, u_int, u_int);
 static int cons_close(struct Fd *);
 static int cons_stat(struct Fd *, struct Stat *);
+static int cons_poll(struct Fd *, int, struct Pollwait *);
 
 struct Dev devcons = {
     .dev_id = 'c',
@@ -13,8 +14,13 @@ struct Dev devcons = {
     .dev_write = cons_write,
     .dev_close = cons_close,
     .dev_stat = cons_stat,
+    .dev_poll = cons_poll,
 };
 
+// A character 'cons_poll' had to take from the console to see that input is ready, which the
+// next 'cons_read' returns (0 if none).
+static int cons_pending;
+
 int iscons(int fdnum) {
 	int r;
 	struct Fd *fd;
@@ -47,8 +53,15 @@ int cons_read(struct Fd *fd, void *vbuf, u_int n, u_int offset) {
 		return 0;
 	}
 
-	while ((c = syscall_cgetc()) == 0) {
-		syscall_yield();
+	// Make prompts written through the stdio buffer visible before we wait for input.
+	fflush(stdout);
+	if ((c = cons_pending) != 0) {
+		cons_pending = 0;
+	}
+	while (c == 0 && (c = syscall_cgetc()) == 0) {
+		// Block in the kernel until input is ready.
+		struct WaitKey cons = {0, 0};
+		syscall_futex_waitv(&cons, 1, 0);
 	}
 
 	if (c != '\r') {
@@ -78,6 +91,22 @@ int cons_close(struct Fd *fd) {
 	return 0;
 }
 
+int cons_poll(struct Fd *fd, int events, struct Pollwait *pw) {
+	int revents = events & POLLOUT;
+
+	if (events & POLLIN) {
+		if (cons_pending == 0) {
+			cons_pending = syscall_cgetc();
+		}
+		if (cons_pending != 0) {
+			revents |= POLLIN;
+		} else {
+			poll_wait(pw, NULL, 0);
+		}
+	}
+	return revents;
+}
+
 int cons_stat(struct Fd *fd, struct Stat *stat) {
 	strcpy(stat->st_name, "<cons>");
 	return 0;
@@ -100,6 +100,7 @@ int close(int fdnum) {
 		return r;
 	}
 
+	stream_close(fdnum);
 	r = (*dev->dev_close)(fd);
 	fd_close(fd);
 	return r;
@@ -145,16 +146,19 @@ int dup(int oldfdnum, int newfdnum) {
 	nva = fd2data(newfd);
 	/* Step 5: Dunplicate the data and 'fd' self from old to new. */
 
-	if (vpd[PDX(ova)]) {
-		for (i = 0; i < PDMAP; i += PTMAP) {
-			pte = vpt[VPN(ova + i)];
-
-			if (pte & PTE_V) {
-				// should be no error here -- pd is already allocated
-				if ((r = syscall_mem_map(0, (void *)(ova + i), 0, (void *)(nva + i),
-							 pte & (PTE_D | PTE_LIBRARY))) < 0) {
-					goto err;
-				}
+	for (i = 0; i < FDDATASIZE; i += PTMAP) {
+		if (!(vpd[PDX(ova + i)] & PTE_V)) {
+			i += PDMAP - PTMAP;
+			continue;
+		}
+		pte = vpt[VPN(ova + i)];
+
+		if (pte & PTE_V) {
+			// should be no error here -- pd is already allocated
+			if ((r = syscall_mem_map(0, (void *)(ova + i), 0, (void *)(nva + i),
+						 pte & (PTE_D | PTE_LIBRARY | PTE_WTRACK | PTE_DIRTY))) <
+			    0) {
+				goto err;
 			}
 		}
 	}
@@ -168,8 +172,10 @@ err:
 	/* If error occurs, cancel all map operations. */
 	panic_on(syscall_mem_unmap(0, newfd));
 
-	for (i = 0; i < PDMAP; i += PTMAP) {
-		panic_on(syscall_mem_unmap(0, (void *)(nva + i)));
+	for (i = 0; i < FDDATASIZE; i += PTMAP) {
+		if ((vpd[PDX(nva + i)] & PTE_V) && (vpt[VPN(nva + i)] & PTE_V)) {
+			panic_on(syscall_mem_unmap(0, (void *)(nva + i)));
+		}
 	}
 
 	return r;
@@ -284,7 +290,7 @@ int fstat(int fdnum, struct Stat *stat) {
 int stat(const char *path, struct Stat *stat) {
 	int fd, r;
 
-	if ((fd = open(path, O_RDONLY)) < 0) {
+	if ((fd = open(path, O_RDONLY | O_STAT)) < 0) {
 		return fd;
 	}
 
@@ -292,3 +298,73 @@ int stat(const char *path, struct Stat *stat) {
 	close(fd);
 	return r;
 }
+
+// Overview:
+//  Have 'poll' block on the word at 'va' while it holds 'val', or on console input if 'va' is
+//  NULL. Called by the 'dev_poll' of devices that are not ready. 'pw' may be NULL.
+void poll_wait(struct Pollwait *pw, u_int *va, u_int val) {
+	if (pw == NULL) {
+		return;
+	}
+	if (pw->pw_nkeys == NWAITKEY) {
+		pw->pw_full = 1;
+		return;
+	}
+	pw->pw_keys[pw->pw_nkeys].wk_va = (u_int)va;
+	pw->pw_keys[pw->pw_nkeys].wk_val = val;
+	pw->pw_nkeys++;
+}
+
+// Overview:
+//  Wait until one of the 'n' entries of 'fds' is ready for the events it asks for, or
+//  'timeout' timer ticks went by (forever if 'timeout' is negative, not at all if it is 0).
+//  The 'revents' of each entry is set to its ready events.
+//  The devices that are not ready give the words to block on in the kernel, so nothing spins.
+//  A device without 'dev_poll' is always ready.
+//
+// Post-Condition:
+//  Return the number of entries with non-zero 'revents', 0 on timeout, or < 0 on error.
+int poll(struct pollfd *fds, u_int n, int timeout) {
+	struct Pollwait pw;
+	struct Fd *fd;
+	struct Dev *dev;
+	u_int start = uinfo->ei_ticks, ticks;
+	int ready, r;
+
+	for (;;) {
+		pw.pw_nkeys = pw.pw_full = 0;
+		ready = 0;
+		for (u_int i = 0; i < n; i++) {
+			fds[i].revents = 0;
+			if (fds[i].fd < 0) {
+				continue;
+			}
+			if (fd_lookup(fds[i].fd, &fd) < 0 || dev_lookup(fd->fd_dev_id, &dev) < 0) {
+				fds[i].revents = POLLNVAL;
+			} else if (dev->dev_poll) {
+				// Once something is ready we won't block, so don't ask for words.
+				fds[i].revents = dev->dev_poll(fd, fds[i].events, ready ? NULL : &pw);
+			} else {
+				fds[i].revents = fds[i].events & (POLLIN | POLLOUT);
+			}
+			ready += fds[i].revents != 0;
+		}
+		if (ready > 0 || timeout == 0) {
+			return ready;
+		}
+		ticks = 0;
+		if (timeout > 0) {
+			if (uinfo->ei_ticks - start >= timeout) {
+				return 0;
+			}
+			ticks = timeout - (uinfo->ei_ticks - start);
+		}
+		// Without all the words, scan again on the next tick.
+		if (pw.pw_full && ticks != 1) {
+			ticks = 1;
+		}
+		if ((r = syscall_futex_waitv(pw.pw_keys, pw.pw_nkeys, ticks)) < 0 && r != -E_TIMEOUT) {
+			return r;
+		}
+	}
+}
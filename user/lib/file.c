@@ -1,4 +1,5 @@
 #include <fs.h>
+#include <fsreq.h>
 #include <lib.h>
 
 #define debug 0
@@ -7,6 +8,7 @@ static int file_close(struct Fd *fd);
 static int file_read(struct Fd *fd, void *buf, u_int n, u_int offset);
 static int file_write(struct Fd *fd, const void *buf, u_int n, u_int offset);
 static int file_stat(struct Fd *fd, struct Stat *stat);
+static int file_poll(struct Fd *fd, int events, struct Pollwait *pw);
 
 // Dot represents choosing the member within the struct declaration
 // to initialize, with no need to consider the order of members.
@@ -17,8 +19,178 @@ struct Dev devfile = {
     .dev_write = file_write,
     .dev_close = file_close,
     .dev_stat = file_stat,
+    .dev_poll = file_poll,
 };
 
+// Number of pages mapped by one fault on file data, counting the faulting page.
+#define FILE_FAULT_AROUND 16
+
+// Ticks a fault waits, one at a time, for the file server's cache to have room for it.
+#define FILE_FAULT_RETRY 64
+
+static int file_page_mapped(const void *va) {
+	return (vpd[PDX(va)] & PTE_V) && (vpt[VPN(va)] & PTE_V);
+}
+
+static int file_send_dirty(struct Fd *fd, int rearm, u_int inflight);
+
+// Overview:
+//  Give the pages of 'fd' back to the file server, whose cache can't evict a block while a
+//  client maps it: report the written ones, then unmap them. They are mapped again on the
+//  next touch. The written pages stay mapped if they couldn't be reported.
+static void file_release(struct Fd *fd) {
+	struct Filefd *ffd = (struct Filefd *)fd;
+	char *va = fd2data(fd);
+	u_int end = ROUND(ffd->f_file.f_size, PTMAP);
+	int sent = file_send_dirty(fd, 0, 1) == 0;
+
+	for (u_int i = 0; i < end; i += PTMAP) {
+		if (file_page_mapped(va + i) && (sent || !(vpt[VPN(va + i)] & PTE_DIRTY))) {
+			syscall_mem_unmap(0, va + i);
+		}
+	}
+}
+
+// Overview:
+//  Handler of faults on unmapped pages of the fd data region. 'open' maps nothing; the pages
+//  of an open file are mapped from the file server on first touch instead, together with up
+//  to FILE_FAULT_AROUND - 1 following pages. Other pages get fresh memory, as the kernel
+//  would have done without this handler.
+//  When the server's cache is full of blocks mapped by clients, the pages of the file are
+//  given back and the fault retried, one page a tick, for the other clients to give back
+//  theirs as well. The access fails after FILE_FAULT_RETRY ticks.
+//  The fault may come while a request page is being filled in, so the requests made here
+//  use a slot of their own (see 'fsipc_set_fault').
+static void __attribute__((noreturn)) file_fault_entry(struct Trapframe *tf) {
+	u_int va = ROUNDDOWN(tf->cp0_badvaddr, PTMAP);
+	int fdnum = DATA2INDEX(va);
+	struct Fd *fd;
+	struct Filefd *ffd;
+	u_int offset, end, n;
+	int r, retry, infault;
+
+	if (fd_lookup(fdnum, &fd) == 0 && fd->fd_dev_id == devfile.dev_id) {
+		ffd = (struct Filefd *)fd;
+		offset = va - (u_int)fd2data(fd);
+		end = ROUND(ffd->f_file.f_size, PTMAP);
+		if (offset < end) {
+			n = MIN((end - offset) / PTMAP, FILE_FAULT_AROUND);
+			infault = fsipc_set_fault(1);
+			for (retry = 0;; retry++) {
+				r = fsipc_map_range(ffd->f_fileid, offset, n, (void *)va);
+				if (r != -E_NO_MEM || retry == FILE_FAULT_RETRY) {
+					break;
+				}
+				file_release(fd);
+				n = 1;
+				syscall_futex_waitv(NULL, 0, 1);
+			}
+			fsipc_set_fault(infault);
+			if (r == -E_NO_MEM) {
+				user_panic("file_fault_entry: file server cache stays full, cannot map "
+					   "%08x",
+					   va);
+			}
+			if (r < 0) {
+				user_panic("file_fault_entry: cannot map %08x: %d", va, r);
+			}
+			r = syscall_set_trapframe(0, tf);
+			user_panic("syscall_set_trapframe returned %d", r);
+		}
+	}
+
+	if ((r = syscall_mem_alloc(0, (void *)va, PTE_D)) < 0) {
+		user_panic("file_fault_entry: cannot allocate %08x: %d", va, r);
+	}
+	r = syscall_set_trapframe(0, tf);
+	user_panic("syscall_set_trapframe returned %d", r);
+}
+
+static struct Fsreq_range dirty_ranges[FSREQ_MAXRANGE];
+
+// Dirty range requests of one file in flight at once.
+#define FILE_DIRTY_INFLIGHT 4
+
+// Overview:
+//  Wait for the 'n' requests in 'tags'.
+//
+// Returns:
+//  0, or the first error of the requests.
+static int file_wait_all(const int *tags, u_int n) {
+	int r = 0, e;
+
+	for (u_int i = 0; i < n; i++) {
+		if ((e = fsipc_wait(tags[i], NULL, NULL)) < 0 && r == 0) {
+			r = e;
+		}
+	}
+	return r;
+}
+
+// Overview:
+//  Tell the file server about the pages of 'fd' written since they were mapped, that is
+//  those the kernel has marked PTE_DIRTY, in as few requests as the ranges fit in. Pages that
+//  were only read cost nothing. If 'rearm' is set, the pages are write-tracked again so that
+//  later writes are caught as well.
+//  A file with more ranges than one request holds keeps up to 'inflight' requests in flight
+//  while the rest of it is scanned: FILE_DIRTY_INFLIGHT, or 1 within the file fault handler,
+//  which has a single request slot.
+static int file_send_dirty(struct Fd *fd, int rearm, u_int inflight) {
+	struct Filefd *ffd = (struct Filefd *)fd;
+	char *va = fd2data(fd);
+	u_int end = ROUND(ffd->f_file.f_size, PTMAP);
+	u_int n = 0, ntag = 0;
+	int tags[FILE_DIRTY_INFLIGHT];
+	int r = 0;
+
+	for (u_int i = 0; i < end && r >= 0; i += PTMAP) {
+		if (!file_page_mapped(va + i) || !(vpt[VPN(va + i)] & PTE_DIRTY)) {
+			continue;
+		}
+		if (n > 0 && dirty_ranges[n - 1].offset + dirty_ranges[n - 1].npages * PTMAP == i) {
+			dirty_ranges[n - 1].npages++;
+		} else {
+			if (n == FSREQ_MAXRANGE) {
+				if (ntag == inflight) {
+					r = file_wait_all(tags, ntag);
+					ntag = 0;
+				}
+				if (r < 0 || (r = fsipc_dirty_range_async(ffd->f_fileid, dirty_ranges, n)) < 0) {
+					break;
+				}
+				tags[ntag++] = r;
+				n = 0;
+			}
+			dirty_ranges[n].offset = i;
+			dirty_ranges[n].npages = 1;
+			n++;
+		}
+		if (rearm) {
+			u_int perm = vpt[VPN(va + i)] & ((1 << PGSHIFT) - 1);
+			perm = (perm & ~(PTE_D | PTE_DIRTY)) | PTE_WTRACK;
+			r = syscall_mem_map(0, va + i, 0, va + i, perm);
+		}
+	}
+	if (r >= 0 && n > 0) {
+		if (ntag == inflight) {
+			r = file_wait_all(tags, ntag);
+			ntag = 0;
+		}
+		if (r >= 0) {
+			r = fsipc_dirty_range(ffd->f_fileid, dirty_ranges, n);
+		}
+	}
+	// Wait for the requests in flight even on error, to release their slots.
+	int e = file_wait_all(tags, ntag);
+	return r < 0 ? r : e;
+}
+
+// Overview:
+//  Register 'file_fault_entry' for the fd data region of 'envid'.
+int file_fault_init(u_int envid) {
+	return syscall_set_pgfault_entry(envid, file_fault_entry, FILEBASE, INDEX2DATA(MAXFD));
+}
+
 // Overview:
 //  Open a file (or directory).
 //
@@ -42,24 +214,12 @@ int open(const char *path, int mode) {
 	if (r < 0) {
 		return r;
 	}
-	// Step 3: Set 'va' to the address of the page where the 'fd''s data is cached, using
-	// 'fd2data'. Set 'size' and 'fileid' correctly with the value in 'fd' as a 'Filefd'.
-	char *va;
-	struct Filefd *ffd;
-	u_int size, fileid;
-	/* Exercise 5.9: Your code here. (3/5) */
-	va = fd2data(fd);
-	ffd = (struct Filefd *)fd;
-	size = ffd->f_file.f_size;
-	fileid = ffd->f_fileid;
-	// Step 4: Map the file content using 'fsipc_map'.
-	for (int i = 0; i < size; i += PTMAP) {
-		/* Exercise 5.9: Your code here. (4/5) */
-		r = fsipc_map(fileid, i, (void *)(va + i));
-		if (r < 0) {
-			return r;
-		}
+	// A named pipe has no content to map: 'fd' becomes an end of the pipe.
+	if (((struct Filefd *)fd)->f_file.f_type == FTYPE_FIFO && !(mode & O_STAT)) {
+		return fifo_open(fd, ((struct Filefd *)fd)->f_fileid, mode);
 	}
+	// Step 3, 4: The file content is not mapped here. Its pages are mapped on first touch by
+	// 'file_fault_entry', so opening a file costs the same whatever its size.
 
 	// Step 5: Return the number of file descriptor using 'fd2num'.
 	/* Exercise 5.9: Your code here. (5/5) */
@@ -82,12 +242,10 @@ int file_close(struct Fd *fd) {
 	// Set the start address storing the file's content.
 	va = fd2data(fd);
 
-	// Tell the file server the dirty page.
-	for (i = 0; i < size; i += PTMAP) {
-		if ((r = fsipc_dirty(fileid, i)) < 0) {
-			debugf("cannot mark pages as dirty\n");
-			return r;
-		}
+	// Tell the file server the dirty pages.
+	if ((r = file_send_dirty(fd, 0, FILE_DIRTY_INFLIGHT)) < 0) {
+		debugf("cannot mark pages as dirty\n");
+		return r;
 	}
 
 	// Request the file server to close the file with fsipc.
@@ -101,6 +259,9 @@ int file_close(struct Fd *fd) {
 		return 0;
 	}
 	for (i = 0; i < size; i += PTMAP) {
+		if (!file_page_mapped(va + i)) {
+			continue;
+		}
 		if ((r = syscall_mem_unmap(0, (void *)(va + i))) < 0) {
 			debugf("cannont unmap the file\n");
 			return r;
@@ -129,7 +290,23 @@ static int file_read(struct Fd *fd, void *buf, u_int n, u_int offset) {
 		n = size - offset;
 	}
 
+	// A tiny file is kept in its 'File', which we got a copy of at open: nothing to map. The
+	// server clears FILE_INLINE in our copy when the data moves to a block.
+	if ((f->f_file.f_flags & FILE_INLINE) && offset + n <= FILE_INLINE_MAX) {
+		memcpy(buf, f->f_file.f_data + offset, n);
+		return n;
+	}
+
 	memcpy(buf, (char *)fd2data(fd) + offset, n);
+
+	// Unmap the pages the read went all the way through, unless they were written, so that a
+	// sequential reader doesn't keep the whole file mapped (and cached by the server).
+	for (u_int i = ROUNDDOWN(offset, PTMAP); i + PTMAP <= offset + n; i += PTMAP) {
+		char *va = (char *)fd2data(fd) + i;
+		if (file_page_mapped(va) && !(vpt[VPN(va)] & PTE_DIRTY)) {
+			syscall_mem_unmap(0, va);
+		}
+	}
 	return n;
 }
 
@@ -155,7 +332,8 @@ int read_map(int fdnum, u_int offset, void **blk) {
 		return -E_NO_DISK;
 	}
 
-	if (!(vpd[PDX(va)] & PTE_V) || !(vpt[VPN(va)] & PTE_V)) {
+	// The page itself is mapped on first touch.
+	if (offset >= ROUND(((struct Filefd *)fd)->f_file.f_size, PTMAP)) {
 		return -E_NO_DISK;
 	}
 
@@ -201,6 +379,12 @@ static int file_stat(struct Fd *fd, struct Stat *st) {
 	return 0;
 }
 
+// Overview:
+//  A regular file never blocks: it is always ready for reading and writing.
+static int file_poll(struct Fd *fd, int events, struct Pollwait *pw) {
+	return events & (POLLIN | POLLOUT);
+}
+
 // Overview:
 //  Truncate or extend an open file to 'size' bytes
 int ftruncate(int fdnum, u_int size) {
@@ -232,19 +416,19 @@ int ftruncate(int fdnum, u_int size) {
 
 	void *va = fd2data(fd);
 
-	// Map any new pages needed if extending the file
+	// New pages of an extended file are mapped on first touch, but drop whatever was faulted in
+	// past the old end so that it can't shadow them.
 	for (i = ROUND(oldsize, PTMAP); i < ROUND(size, PTMAP); i += PTMAP) {
-		if ((r = fsipc_map(fileid, i, va + i)) < 0) {
-			int _r = fsipc_set_size(fileid, oldsize);
-			if (_r < 0) {
-				return _r;
-			}
-			return r;
+		if (file_page_mapped(va + i) && (r = syscall_mem_unmap(0, (void *)(va + i))) < 0) {
+			user_panic("ftruncate: syscall_mem_unmap %08x: %d\n", va + i, r);
 		}
 	}
 
 	// Unmap pages if truncating the file
 	for (i = ROUND(size, PTMAP); i < ROUND(oldsize, PTMAP); i += PTMAP) {
+		if (!file_page_mapped(va + i)) {
+			continue;
+		}
 		if ((r = syscall_mem_unmap(0, (void *)(va + i))) < 0) {
 			user_panic("ftruncate: syscall_mem_unmap %08x: %d\n", va + i, r);
 		}
@@ -268,10 +452,148 @@ int sync(void) {
 	return fsipc_sync();
 }
 
+// Overview:
+//  Write the contents of an open file to disk before returning. The file server writes
+//  back dirty blocks lazily, so this is the only guarantee short of 'sync'.
+int fsync(int fdnum) {
+	int r;
+	struct Fd *fd;
+	struct Filefd *f;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0) {
+		return r;
+	}
+	if (fd->fd_dev_id != devfile.dev_id) {
+		return -E_INVAL;
+	}
+
+	// Our writes went straight into the shared pages; tell the server about them.
+	f = (struct Filefd *)fd;
+	try(file_send_dirty(fd, 1, FILE_DIRTY_INFLIGHT));
+	return fsipc_fsync(f->f_fileid);
+}
+
 
 int create(const char *path, int f_type) {
 	return fsipc_create(path, f_type);
 }
+
+// Overview:
+//  Create the named pipe 'path'. Opening it for reading and for writing connects the two
+//  ends, like the ends made by 'pipe', whoever opens them.
+int mkfifo(const char *path) {
+	return create(path, FTYPE_FIFO);
+}
+
+// Largest copy asked of the file server at once, so that it serves others in between.
+#define FILE_COPY_CHUNK (64 * BLOCK_SIZE)
+
+// Overview:
+//  Copy up to 'len' bytes from the seek position of file 'fd_in' to the seek position of
+//  file 'fd_out', and advance both. The file server copies the blocks itself: the data is
+//  neither read into nor written from this env.
+//
+// Returns:
+//  the number of bytes copied (0 at the end of 'fd_in'), or the underlying error if none
+//  could be.
+int copy_file_range(int fd_in, int fd_out, u_int len) {
+	struct Fd *in, *out;
+	struct Filefd *fin, *fout;
+	u_int n, done;
+	int r = 0;
+
+	if ((r = fd_lookup(fd_in, &in)) < 0 || (r = fd_lookup(fd_out, &out)) < 0) {
+		return r;
+	}
+	if (in->fd_dev_id != devfile.dev_id || out->fd_dev_id != devfile.dev_id ||
+	    (in->fd_omode & O_ACCMODE) == O_WRONLY || (out->fd_omode & O_ACCMODE) == O_RDONLY) {
+		return -E_INVAL;
+	}
+	fin = (struct Filefd *)in;
+	fout = (struct Filefd *)out;
+
+	if (in->fd_offset >= fin->f_file.f_size) {
+		return 0;
+	}
+	len = MIN(len, fin->f_file.f_size - in->fd_offset);
+	if (out->fd_offset > MAXFILESIZE || len > MAXFILESIZE - out->fd_offset) {
+		return -E_NO_DISK;
+	}
+	if (out->fd_offset + len > fout->f_file.f_size) {
+		try(ftruncate(fd_out, out->fd_offset + len));
+	}
+
+	for (done = 0; done < len; done += n) {
+		n = MIN(len - done, FILE_COPY_CHUNK);
+		if ((r = fsipc_copy(fout->f_fileid, out->fd_offset + done, fin->f_fileid,
+				    in->fd_offset + done, n)) < 0) {
+			break;
+		}
+	}
+	in->fd_offset += done;
+	out->fd_offset += done;
+	return done ? done : r;
+}
+
+// Overview:
+//  Send up to 'len' bytes from the seek position of file 'fd_in' to 'fd_out' (a pipe, say),
+//  and advance both. To another file this is 'copy_file_range'. To a pipe the data is
+//  written straight from the pages of 'fd_in' mapped from the file server, instead of
+//  being read into a buffer of the caller first. Other devices may pass the buffer to
+//  the kernel, which would map a fresh page over a file page not faulted in yet, so
+//  those get the data through a buffer of ours.
+//
+// Returns:
+//  the number of bytes sent (0 at the end of 'fd_in'), or the underlying error.
+int sendfile(int fd_out, int fd_in, u_int len) {
+	struct Fd *in, *out;
+	struct Filefd *fin;
+	static char buf[BLOCK_SIZE];
+	char *data;
+	u_int done;
+	int r, w;
+
+	if ((r = fd_lookup(fd_in, &in)) < 0 || (r = fd_lookup(fd_out, &out)) < 0) {
+		return r;
+	}
+	if (out->fd_dev_id == devfile.dev_id) {
+		return copy_file_range(fd_in, fd_out, len);
+	}
+	if (in->fd_dev_id != devfile.dev_id || (in->fd_omode & O_ACCMODE) == O_WRONLY) {
+		return -E_INVAL;
+	}
+	fin = (struct Filefd *)in;
+
+	if (in->fd_offset >= fin->f_file.f_size) {
+		return 0;
+	}
+	len = MIN(len, fin->f_file.f_size - in->fd_offset);
+	if (out->fd_dev_id != devpipe.dev_id) {
+		for (done = 0; done < len; done += w) {
+			if ((r = read(fd_in, buf, MIN(len - done, BLOCK_SIZE))) <= 0) {
+				break;
+			}
+			if ((w = write(fd_out, buf, r)) < r) {
+				in->fd_offset -= r - MAX(w, 0);
+				if (w > 0) {
+					done += w;
+				}
+				r = w;
+				break;
+			}
+		}
+		return done ? done : r;
+	}
+
+	data = fd2data(in);
+	if ((fin->f_file.f_flags & FILE_INLINE) && in->fd_offset + len <= FILE_INLINE_MAX) {
+		data = fin->f_file.f_data;
+	}
+	if ((r = write(fd_out, data + in->fd_offset, len)) > 0) {
+		in->fd_offset += r;
+	}
+	return r;
+}
 // int openat(int dirfd, const char *path, int mode) {
 // 	int r;
 // 	// Step 1: Alloc a new 'Fd' using 'fd_alloc' in fd.c.
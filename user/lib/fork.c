@@ -47,6 +47,17 @@ static void __attribute__((noreturn)) cow_entry(struct Trapframe *tf) {
 	user_panic("syscall_set_trapframe returned %d", r);
 }
 
+/* Overview:
+ *   Make sure our TLB Mod user exception entry is 'cow_entry', so that pages we map PTE_COW
+ *   get copied on the first write.
+ */
+int cow_init(void) {
+	if (env->env_user_tlb_mod_entry != (u_int)cow_entry) {
+		try(syscall_set_tlb_mod_entry(0, cow_entry));
+	}
+	return 0;
+}
+
 /* Overview:
  *   Grant our child 'envid' access to the virtual page 'vpn' (with address 'vpn' * 'PAGE_SIZE') in
  * our (current env's) address space. 'PTE_COW' should be used to isolate the modifications on
@@ -117,16 +128,19 @@ int fork(void) {
 	u_int i;
 
 	/* Step 1: Set our TLB Mod user exception entry to 'cow_entry' if not done yet. */
-	if (env->env_user_tlb_mod_entry != (u_int)cow_entry) {
-		try(syscall_set_tlb_mod_entry(0, cow_entry));
-	}
+	try(cow_init());
+
+#if !defined(LAB) || LAB >= 5
+	// Write out buffered output first, or both of us would print it.
+	fflush(NULL);
+#endif
 
 	/* Step 2: Create a child env that's not ready to be scheduled. */
 	// Hint: 'env' should always point to the current env itself, so we should fix it to the
 	// correct value.
 	child = syscall_exofork();
 	if (child == 0) {
-		env = envs + ENVX(syscall_getenvid());
+		env = envs + ENVX(uinfo->ei_envid);
 		return 0;
 	}
 
@@ -146,6 +160,10 @@ int fork(void) {
 	 */
 	/* Exercise 4.15: Your code here. (2/2) */
 	try(syscall_set_tlb_mod_entry(child, cow_entry));
+#if !defined(LAB) || LAB >= 5
+	// The child shares our fd table, so its file data pages are demand-paged the same way.
+	try(file_fault_init(child));
+#endif
 	try(syscall_set_env_status(child, ENV_RUNNABLE));
 	return child;
 }
@@ -3,6 +3,7 @@
 
 struct print_ctx {
 	int fd;
+	FILE *fp;
 	int ret;
 };
 
@@ -11,7 +12,7 @@ static void print_output(void *data, const char *s, size_t l) {
 	if (ctx->ret < 0) {
 		return;
 	}
-	int r = write(ctx->fd, s, l);
+	int r = ctx->fp ? stream_write(ctx->fp, s, l) : write(ctx->fd, s, l);
 	if (r < 0) {
 		ctx->ret = r;
 	} else {
@@ -19,9 +20,12 @@ static void print_output(void *data, const char *s, size_t l) {
 	}
 }
 
+// Output to a descriptor that has a stream (e.g. the standard output) goes through the
+// stream's buffer, so that it stays ordered with 'putchar' and 'fputs'.
 static int vfprintf(int fd, const char *fmt, va_list ap) {
 	struct print_ctx ctx;
 	ctx.fd = fd;
+	ctx.fp = stream_lookup(fd);
 	ctx.ret = 0;
 	vprintfmt(print_output, &ctx, fmt, ap);
 	return ctx.ret;
@@ -4,14 +4,349 @@
 
 #define debug 0
 
-u_char fsipcbuf[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+// Reply pages of a request are received here, and moved to where the request wants them,
+// when other requests expecting pages are in flight too.
+#define FSIPC_STAGEVA (FDTABLE - IPC_MAXPAGES * PAGE_SIZE)
+
+// The ring shared with the file server (see 'struct Fsring').
+#define FSRING_VA (FSIPC_STAGEVA - PAGE_SIZE)
+
+// One request page for each of the FSIPC_NSLOT requests that may be in flight.
+u_char fsipcbuf[FSIPC_NSLOT][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+struct FsipcSlot {
+	u_int fs_tag;	 // tag of the request using the slot, or 0 if the slot is free
+	u_int fs_done;	 // the reply has come
+	u_int fs_ring;	 // the request went through the ring
+	u_int fs_len;	 // with that much data
+	int fs_result;
+	void *fs_dstva;	 // where the reply pages go
+	u_int fs_npages; // how many are expected
+	u_int fs_perm;	 // and their permissions
+};
+
+static struct FsipcSlot fsipc_slots[FSIPC_NSLOT];
+static u_int fsipc_seq;
+
+// The last slot is kept for the requests of the file fault handler, which may run while a
+// request page of the others is being filled in (from a file page, say).
+#define FSIPC_FAULT_SLOT (FSIPC_NSLOT - 1)
+static int fsipc_infault;
+
+static struct Fsring *fsring;
+static u_int fsring_envid; // env that set the ring up: a child of it sets up its own
+
+// Overview:
+//  Take the next message of the file server: complete the request it replies to.
+//
+// Returns:
+//  1 if it was the server waking us up instead, 0 otherwise.
+static int fsipc_reap(void) {
+	struct FsipcSlot *s, *to = NULL;
+	u_int whom, tag, n, perm;
+	void *dstva = (void *)FSIPC_STAGEVA;
+
+	// Receive in place if only one request in flight expects pages.
+	for (int i = 0; i < FSIPC_NSLOT; i++) {
+		s = &fsipc_slots[i];
+		if (s->fs_tag && !s->fs_done && s->fs_npages) {
+			if (to) {
+				to = NULL;
+				break;
+			}
+			to = s;
+		}
+	}
+	if (to) {
+		dstva = to->fs_dstva;
+	}
+
+	n = to ? to->fs_npages : IPC_MAXPAGES;
+	tag = ipc_recv_pages(&whom, dstva, &n, &perm);
+	if (tag == FSRING_WAKE) {
+		return 1;
+	}
+	s = &fsipc_slots[tag % FSIPC_NSLOT];
+	if (s->fs_tag != tag || s->fs_done || s->fs_ring) {
+		user_panic("fsipc: unexpected reply %x from %08x", tag, whom);
+	}
+	if (n && dstva != s->fs_dstva) {
+		for (u_int i = 0; i < n; i++) {
+			panic_on(syscall_mem_map(0, dstva + i * PAGE_SIZE, 0,
+						 s->fs_dstva + i * PAGE_SIZE, perm));
+			panic_on(syscall_mem_unmap(0, dstva + i * PAGE_SIZE));
+		}
+	}
+	s->fs_result = FSREQ_TAG(fsipcbuf[tag % FSIPC_NSLOT])->req_result;
+	s->fs_npages = n;
+	s->fs_perm = perm;
+	s->fs_done = 1;
+	return 0;
+}
+
+// Overview:
+//  Complete the requests whose completions the server has queued in the ring. The data
+//  the server left in a ring entry is copied back to the request page.
+//
+// Returns:
+//  the number of requests completed.
+static int fsring_reap(void) {
+	struct Fsring *ring = fsring_envid == env->env_id ? fsring : NULL;
+	struct Fsring_cqe *c;
+	struct FsipcSlot *s;
+	int n = 0;
+
+	while (ring && ring->r_cq_head != ring->r_cq_tail) {
+		__sync_synchronize();
+		c = &ring->r_cq[ring->r_cq_head % FSIPC_NSLOT];
+		s = &fsipc_slots[c->cqe_tag % FSIPC_NSLOT];
+		if (s->fs_tag != c->cqe_tag || s->fs_done || !s->fs_ring) {
+			user_panic("fsipc: unexpected completion %x", c->cqe_tag);
+		}
+		memcpy(fsipcbuf[c->cqe_tag % FSIPC_NSLOT],
+		       ring->r_sqe[c->cqe_tag % FSIPC_NSLOT].sqe_req, s->fs_len);
+		s->fs_result = c->cqe_result;
+		s->fs_npages = 0;
+		s->fs_perm = 0;
+		s->fs_done = 1;
+		ring->r_cq_head++;
+		n++;
+	}
+	return n;
+}
+
+// Overview:
+//  Wait for any request in flight to complete.
+static void fsipc_progress(void) {
+	if (fsring_reap()) {
+		return;
+	}
+	for (int i = 0; i < FSIPC_NSLOT; i++) {
+		struct FsipcSlot *s = &fsipc_slots[i];
+		if (s->fs_tag && !s->fs_done && !s->fs_ring) {
+			fsipc_reap();
+			return;
+		}
+	}
+	// Only ring requests are in flight: their completions need no message.
+	syscall_yield();
+}
+
+// Overview:
+//  Send message 'type', with the page 'fsreq' unless it is NULL, to the file server.
+//  Our file system server must be the 2nd env. It only takes a message when it has a
+//  worker free, and the workers may be waiting to reply to us: take their replies.
+static void fsipc_send(u_int type, void *fsreq) {
+	int r;
+
+	while ((r = syscall_ipc_try_send(envs[1].env_id, type, fsreq, fsreq ? PTE_D : 0)) ==
+	       -E_IPC_NOT_RECV) {
+		fsipc_progress();
+	}
+	user_assert(r == 0);
+}
+
+// Overview:
+//  Get the ring of this env, registering it with the file server on first use. The page is
+//  PTE_LIBRARY, so that the server keeps seeing the one we write to after a fork; a child
+//  registers a ring of its own.
+//
+// Returns:
+//  the ring, or NULL if the server has none for us or requests are in flight (registering
+//  is a plain request-reply exchange, so it waits until there are none).
+static struct Fsring *fsring_get(void) {
+	u_int whom;
+
+	if (fsring_envid == env->env_id) {
+		return fsring;
+	}
+	for (int i = 0; i < FSIPC_NSLOT; i++) {
+		if (fsipc_slots[i].fs_tag && !fsipc_slots[i].fs_done) {
+			return NULL;
+		}
+	}
+	fsring_envid = env->env_id;
+	fsring = NULL;
+	if (syscall_mem_alloc(0, (void *)FSRING_VA, PTE_D | PTE_LIBRARY) < 0) {
+		return NULL;
+	}
+	ipc_send(envs[1].env_id, FSREQ_RING, (void *)FSRING_VA, PTE_D);
+	if (ipc_recv(&whom, 0, 0) == 0) {
+		fsring = (struct Fsring *)FSRING_VA;
+	}
+	return fsring;
+}
+
+// Overview:
+//  Length of the data of request 'type' in 'fsreq' if it may go through the ring, or -1.
+static int fsipc_reqlen(u_int type, void *fsreq) {
+	struct Fsreq_dirty_range *rq = fsreq;
+	u_int len;
+
+	switch (type) {
+	case FSREQ_SET_SIZE:
+		len = sizeof(struct Fsreq_set_size);
+		break;
+	case FSREQ_CLOSE:
+		len = sizeof(struct Fsreq_close);
+		break;
+	case FSREQ_DIRTY:
+		len = sizeof(struct Fsreq_dirty);
+		break;
+	case FSREQ_FSYNC:
+		len = sizeof(struct Fsreq_fsync);
+		break;
+	case FSREQ_SYNC:
+		len = 0;
+		break;
+	case FSREQ_CACHE_STAT:
+		len = sizeof(struct Fsreq_cache_stat);
+		break;
+	case FSREQ_DIRTY_RANGE:
+		len = (u_int)&rq->req_range[rq->req_nrange] - (u_int)rq;
+		break;
+	case FSREQ_COPY:
+		len = sizeof(struct Fsreq_copy);
+		break;
+	default:
+		return -1;
+	}
+	return len <= FSRING_REQSIZE ? len : -1;
+}
+
+// Overview:
+//  Make the requests from now on use the slot of the file fault handler if 'infault' is set,
+//  or the other slots if not.
+//
+// Returns:
+//  the previous setting.
+int fsipc_set_fault(int infault) {
+	int old = fsipc_infault;
+
+	fsipc_infault = infault;
+	return old;
+}
+
+// Overview:
+//  Get the request page of a free slot, waiting for requests in flight to complete if
+//  there is none. Within the file fault handler, that is the slot kept for it.
+//
+// Post-Condition:
+//  Panic if all slots hold completed requests nobody waited for.
+static void *fsipc_req(void) {
+	for (;;) {
+		int busy = 0;
+		for (int i = 0; i < FSIPC_NSLOT; i++) {
+			if ((i == FSIPC_FAULT_SLOT) != fsipc_infault) {
+				continue;
+			}
+			if (fsipc_slots[i].fs_tag == 0) {
+				return fsipcbuf[i];
+			}
+			busy |= !fsipc_slots[i].fs_done;
+		}
+		if (!busy) {
+			user_panic("fsipc: no request slot left, a tag was not waited for");
+		}
+		fsipc_progress();
+	}
+}
+
+// Overview:
+//  Send the request in 'fsreq', a page from 'fsipc_req', to the file server without waiting
+//  for the reply. The reply pages, at most 'npages' of them, will be mapped from 'dstva'.
+//  A small request that takes no pages goes through the ring instead, and the server is
+//  only sent a message if it is idle.
+//
+// Returns:
+//  the tag of the request, to be passed to 'fsipc_wait'.
+static int fsipc_submit(u_int type, void *fsreq, void *dstva, u_int npages) {
+	u_int slot = ((u_char(*)[PAGE_SIZE])fsreq - fsipcbuf);
+	struct FsipcSlot *s = &fsipc_slots[slot];
+	struct Fsring *ring;
+	struct Fsring_sqe *e;
+	int len = dstva ? -1 : fsipc_reqlen(type, fsreq);
+	u_int tag;
+
+	fsipc_seq = fsipc_seq % 0xffffff + 1;
+	tag = fsipc_seq * FSIPC_NSLOT + slot;
+
+	if (len >= 0 && (ring = fsring_get()) != NULL) {
+		e = &ring->r_sqe[slot];
+		memcpy(e->sqe_req, fsreq, len);
+		e->sqe_tag = tag;
+		e->sqe_type = type;
+		ring->r_sq[ring->r_sq_tail % FSIPC_NSLOT] = slot;
+		__sync_synchronize();
+		ring->r_sq_tail++;
+		__sync_synchronize();
+	} else {
+		len = -1;
+		FSREQ_TAG(fsreq)->req_tag = tag;
+		fsipc_send(type, fsreq);
+	}
+
+	s->fs_tag = tag;
+	s->fs_done = 0;
+	s->fs_ring = len >= 0;
+	s->fs_len = len;
+	s->fs_dstva = dstva;
+	s->fs_npages = dstva ? npages : 0;
+
+	if (s->fs_ring && __sync_bool_compare_and_swap(&ring->r_sidle, 1, 0)) {
+		fsipc_send(FSREQ_KICK, NULL);
+	}
+	return tag;
+}
+
+// Overview:
+//  Wait for the request 'tag' to complete, and release its slot.
+//
+// Returns:
+//  the result of the request. '*npages' (if not NULL) is set to the number of reply pages
+//  and '*perm' (if not NULL) to their permissions.
+int fsipc_wait(int tag, u_int *npages, u_int *perm) {
+	struct FsipcSlot *s = &fsipc_slots[tag % FSIPC_NSLOT];
+	int wake = 0;
+
+	if (tag <= 0 || s->fs_tag != tag) {
+		return -E_INVAL;
+	}
+	while (!s->fs_done || wake) {
+		if (wake) {
+			wake = !fsipc_reap();
+		} else if (fsring_reap()) {
+			continue;
+		} else if (!s->fs_ring) {
+			fsipc_reap();
+		} else {
+			// Tell the server to wake us up, unless the completion has come meanwhile.
+			fsring->r_cwait = 1;
+			__sync_synchronize();
+			if (fsring->r_cq_head == fsring->r_cq_tail && fsipc_reap()) {
+				continue; // the server has cleared 'r_cwait'
+			}
+			// Something else came first: take our word back, unless the server has
+			// already taken it, and will wake us up.
+			wake = !__sync_bool_compare_and_swap(&fsring->r_cwait, 1, 0);
+		}
+	}
+	if (npages) {
+		*npages = s->fs_npages;
+	}
+	if (perm) {
+		*perm = s->fs_perm;
+	}
+	s->fs_tag = 0;
+	return s->fs_result;
+}
 
 // Overview:
 //  Send an IPC request to the file server, and wait for a reply.
 //
 // Parameters:
 //  @type: request code, passed as the simple integer IPC value.
-//  @fsreq: page to send containing additional request data, usually fsipcbuf.
+//  @fsreq: page to send containing additional request data, from 'fsipc_req'.
 //          Can be modified by server to return additional response info.
 //  @dstva: virtual address at which to receive reply page, 0 if none.
 //  @*perm: permissions of received page.
@@ -20,10 +355,14 @@ u_char fsipcbuf[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
 //  0 if successful,
 //  < 0 on failure.
 static int fsipc(u_int type, void *fsreq, void *dstva, u_int *perm) {
-	u_int whom;
-	// Our file system server must be the 2nd env.
-	ipc_send(envs[1].env_id, type, fsreq, PTE_D);
-	return ipc_recv(&whom, dstva, perm);
+	return fsipc_wait(fsipc_submit(type, fsreq, dstva, 1), NULL, perm);
+}
+
+// Overview:
+//  Like 'fsipc', but receive up to '*npages' reply pages mapped consecutively from 'dstva'.
+//  On return '*npages' holds the number of pages received.
+static int fsipc_pages(u_int type, void *fsreq, void *dstva, u_int *npages, u_int *perm) {
+	return fsipc_wait(fsipc_submit(type, fsreq, dstva, *npages), npages, perm);
 }
 
 // Overview:
@@ -37,7 +376,7 @@ int fsipc_open(const char *path, u_int omode, struct Fd *fd) {
 	u_int perm;
 	struct Fsreq_open *req;
 
-	req = (struct Fsreq_open *)fsipcbuf;
+	req = fsipc_req();
 
 	// The path is too long.
 	if (strlen(path) >= MAXPATHLEN) {
@@ -62,7 +401,7 @@ int fsipc_map(u_int fileid, u_int offset, void *dstva) {
 	u_int perm;
 	struct Fsreq_map *req;
 
-	req = (struct Fsreq_map *)fsipcbuf;
+	req = fsipc_req();
 	req->req_fileid = fileid;
 	req->req_offset = offset;
 
@@ -70,19 +409,49 @@ int fsipc_map(u_int fileid, u_int offset, void *dstva) {
 		return r;
 	}
 
-	if ((perm & ~(PTE_D | PTE_LIBRARY)) != (PTE_V)) {
+	if ((perm & ~(PTE_WTRACK | PTE_LIBRARY)) != (PTE_V)) {
 		user_panic("fsipc_map: unexpected permissions %08x for dstva %08x", perm, dstva);
 	}
 
 	return 0;
 }
 
+// Overview:
+//  Make a map-range request to the file server: map 'npages' (at most IPC_MAXPAGES)
+//  consecutive blocks of the file, starting at byte 'offset', from 'dstva' on.
+//
+// Returns:
+//  0 on success,
+//  < 0 on failure.
+int fsipc_map_range(u_int fileid, u_int offset, u_int npages, void *dstva) {
+	int r;
+	u_int perm, n = npages;
+	struct Fsreq_map_range *req;
+
+	req = fsipc_req();
+	req->req_fileid = fileid;
+	req->req_offset = offset;
+	req->req_npages = npages;
+
+	if ((r = fsipc_pages(FSREQ_MAP_RANGE, req, dstva, &n, &perm)) < 0) {
+		return r;
+	}
+
+	if (n != npages || (perm & ~(PTE_WTRACK | PTE_LIBRARY)) != (PTE_V)) {
+		user_panic("fsipc_map_range: unexpected reply of %d pages, permissions %08x for "
+			   "dstva %08x",
+			   n, perm, dstva);
+	}
+
+	return 0;
+}
+
 // Overview:
 //  Make a set-file-size request to the file server.
 int fsipc_set_size(u_int fileid, u_int size) {
 	struct Fsreq_set_size *req;
 
-	req = (struct Fsreq_set_size *)fsipcbuf;
+	req = fsipc_req();
 	req->req_fileid = fileid;
 	req->req_size = size;
 	return fsipc(FSREQ_SET_SIZE, req, 0, 0);
@@ -93,7 +462,7 @@ int fsipc_set_size(u_int fileid, u_int size) {
 int fsipc_close(u_int fileid) {
 	struct Fsreq_close *req;
 
-	req = (struct Fsreq_close *)fsipcbuf;
+	req = fsipc_req();
 	req->req_fileid = fileid;
 	return fsipc(FSREQ_CLOSE, req, 0, 0);
 }
@@ -103,12 +472,67 @@ int fsipc_close(u_int fileid) {
 int fsipc_dirty(u_int fileid, u_int offset) {
 	struct Fsreq_dirty *req;
 
-	req = (struct Fsreq_dirty *)fsipcbuf;
+	req = fsipc_req();
 	req->req_fileid = fileid;
 	req->req_offset = offset;
 	return fsipc(FSREQ_DIRTY, req, 0, 0);
 }
 
+// Overview:
+//  Ask the file server to mark the pages in 'nrange' ranges of a file dirty, at most
+//  FSREQ_MAXRANGE of them, without waiting for it.
+//
+// Returns:
+//  the tag of the request, to be passed to 'fsipc_wait'.
+int fsipc_dirty_range_async(u_int fileid, const struct Fsreq_range *ranges, u_int nrange) {
+	struct Fsreq_dirty_range *req;
+
+	if (nrange > FSREQ_MAXRANGE) {
+		return -E_INVAL;
+	}
+	req = fsipc_req();
+	req->req_fileid = fileid;
+	req->req_nrange = nrange;
+	memcpy(req->req_range, ranges, nrange * sizeof(struct Fsreq_range));
+	return fsipc_submit(FSREQ_DIRTY_RANGE, req, 0, 0);
+}
+
+// Overview:
+//  Ask the file server to mark the pages in 'nrange' ranges of a file dirty, at most
+//  FSREQ_MAXRANGE of them.
+int fsipc_dirty_range(u_int fileid, const struct Fsreq_range *ranges, u_int nrange) {
+	int tag = fsipc_dirty_range_async(fileid, ranges, nrange);
+
+	return tag < 0 ? tag : fsipc_wait(tag, NULL, NULL);
+}
+
+// Overview:
+//  Ask the file server to copy 'len' bytes of file 'src_fileid' from 'src_offset' on to file
+//  'fileid' at 'offset'. The data is copied in the server's block cache.
+int fsipc_copy(u_int fileid, u_int offset, u_int src_fileid, u_int src_offset, u_int len) {
+	struct Fsreq_copy *req;
+
+	req = fsipc_req();
+	req->req_fileid = fileid;
+	req->req_offset = offset;
+	req->req_src_fileid = src_fileid;
+	req->req_src_offset = src_offset;
+	req->req_len = len;
+	return fsipc(FSREQ_COPY, req, 0, 0);
+}
+
+// Overview:
+//  Ask the file server for the page shared by the ends of the named pipe open as 'fileid',
+//  and map it at 'dstva'.
+int fsipc_fifo(u_int fileid, void *dstva) {
+	struct Fsreq_fifo *req;
+	u_int perm;
+
+	req = fsipc_req();
+	req->req_fileid = fileid;
+	return fsipc(FSREQ_FIFO, req, dstva, &perm);
+}
+
 // Overview:
 //  Ask the file server to delete a file, given its path.
 int fsipc_remove(const char *path) {
@@ -119,22 +543,45 @@ int fsipc_remove(const char *path) {
 	if (len == 0 || len >= MAXPATHLEN) {
 		return -E_BAD_PATH;
 	}
-	// Step 2: Use 'fsipcbuf' as a 'struct Fsreq_remove'.
-	struct Fsreq_remove *req = (struct Fsreq_remove *)fsipcbuf;
+	// Step 2: Take a request page with 'fsipc_req' for a 'struct Fsreq_remove'.
+	struct Fsreq_remove *req = fsipc_req();
 
 	// Step 3: Copy 'path' into the path in 'req' using 'strcpy'.
 	/* Exercise 5.12: Your code here. (2/3) */
 	strcpy(req->req_path, path);
 	// Step 4: Send request to the server using 'fsipc'.
 	/* Exercise 5.12: Your code here. (3/3) */
-	fsipc(FSREQ_REMOVE, req, 0, 0);
+	return fsipc(FSREQ_REMOVE, req, 0, 0);
 }
 
 // Overview:
 //  Ask the file server to update the disk by writing any dirty
 //  blocks in the buffer cache.
 int fsipc_sync(void) {
-	return fsipc(FSREQ_SYNC, fsipcbuf, 0, 0);
+	return fsipc(FSREQ_SYNC, fsipc_req(), 0, 0);
+}
+
+// Overview:
+//  Ask the file server to write a file and its metadata to disk.
+int fsipc_fsync(u_int fileid) {
+	struct Fsreq_fsync *req;
+
+	req = fsipc_req();
+	req->req_fileid = fileid;
+	return fsipc(FSREQ_FSYNC, req, 0, 0);
+}
+
+// Overview:
+//  Ask the file server for its block cache counters.
+int fsipc_cache_stat(struct BlockCacheStat *stat) {
+	struct Fsreq_cache_stat *req = fsipc_req();
+	int r;
+
+	if ((r = fsipc(FSREQ_CACHE_STAT, req, 0, 0)) < 0) {
+		return r;
+	}
+	*stat = req->req_stat;
+	return 0;
 }
 
 int fsipc_create(const char* path, int f_type) {
@@ -142,7 +589,7 @@ int fsipc_create(const char* path, int f_type) {
 	if (len == 0 || len >= MAXPATHLEN) {
 		return -E_BAD_PATH;
 	}
-	struct Fsreq_create *req = (struct Fsreq_create *)fsipcbuf;
+	struct Fsreq_create *req = fsipc_req();
 	req->f_type = f_type;
 	strcpy(req->req_path, path);
 	return fsipc(FSREQ_CREATE, req, 0, 0);
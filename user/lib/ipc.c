@@ -38,6 +38,37 @@ u_int ipc_recv(u_int *whom, void *dstva, u_int *perm) {
 	return env->env_ipc_value;
 }
 
+// Send val to whom together with 'npages' pages, the i-th of which is mapped at
+// the receiver's dstva + i * PAGE_SIZE. Like 'ipc_send', keep trying until it succeeds.
+void ipc_send_pages(u_int whom, u_int val, void *const *srcvas, u_int npages, u_int perm) {
+	int r;
+	while ((r = syscall_ipc_try_send_pages(whom, val, srcvas, npages, perm)) ==
+	       -E_IPC_NOT_RECV) {
+		syscall_yield();
+	}
+	user_assert(r == 0);
+}
+
+// Receive a value together with up to *npages pages mapped consecutively from dstva.
+// On return *npages holds the number of pages actually received.
+u_int ipc_recv_pages(u_int *whom, void *dstva, u_int *npages, u_int *perm) {
+	int r = syscall_ipc_recv_pages(dstva, *npages);
+	if (r != 0) {
+		user_panic("syscall_ipc_recv_pages err: %d", r);
+	}
+
+	if (whom) {
+		*whom = env->env_ipc_from;
+	}
+
+	if (perm) {
+		*perm = env->env_ipc_perm;
+	}
+
+	*npages = env->env_ipc_npages;
+	return env->env_ipc_value;
+}
+
 // u_int get_time(u_int *us) {
 // 	u_int triger = 0x0000;
 // 	u_int reads = 0x0010;
@@ -5,6 +5,7 @@
 void exit(int flag) {
 	// After fs is ready (lab5), all our open files should be closed before dying.
 #if !defined(LAB) || LAB >= 5
+	fflush(NULL);
 	close_all();
 #endif
 
@@ -19,7 +20,12 @@ extern int main(int, char **);
 
 void libmain(int argc, char **argv) {
 	// set env to point at our env structure in envs[].
-	env = &envs[ENVX(syscall_getenvid())];
+	env = &envs[ENVX(uinfo->ei_envid)];
+
+#if !defined(LAB) || LAB >= 5
+	// Fault in the data pages of open files (including those inherited from our parent).
+	panic_on(file_fault_init(0));
+#endif
 
 	// call user main routine
 	int flag = main(argc, argv);
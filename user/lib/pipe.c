@@ -7,6 +7,7 @@ static int pipe_close(struct Fd *);
 static int pipe_read(struct Fd *fd, void *buf, u_int n, u_int offset);
 static int pipe_stat(struct Fd *, struct Stat *);
 static int pipe_write(struct Fd *fd, const void *buf, u_int n, u_int offset);
+static int pipe_poll(struct Fd *, int, struct Pollwait *);
 
 struct Dev devpipe = {
     .dev_id = 'p',
@@ -15,16 +16,56 @@ struct Dev devpipe = {
     .dev_write = pipe_write,
     .dev_close = pipe_close,
     .dev_stat = pipe_stat,
+    .dev_poll = pipe_poll,
 };
 
-#define PIPE_SIZE 32 // small to provoke races
+// Set to 1 to shrink the buffer to 32 bytes: the ring then wraps and fills up all the time,
+// which is good to provoke races.
+#define PIPE_RACE 0
 
+// Whole pages written from page-aligned addresses are not copied into the ring: they are
+// parked in the kernel (see 'sys_page_park') and shared copy-on-write with the reader, which
+// maps them. Up to PIPE_NPAGES of them may be queued.
+#define PIPE_NPAGES 8
+
+#if PIPE_RACE
+#define PIPE_SIZE 32
+#else
+#define PIPE_SIZE (PAGE_SIZE - (11 + PIPE_NPAGES) * sizeof(u_int)) // the rest of the data page
+#endif
+
+// 'p_rpos' and 'p_wpos' count modulo twice the size, so that a full ring is told apart from an
+// empty one even though PIPE_SIZE is not a power of 2.
+#define PIPE_WRAP (2 * PIPE_SIZE)
+
+// A blocked end checks again whether the pipe got closed after this many ticks, in case the
+// peer was destroyed without closing it.
+#define PIPE_WAIT_TICKS 10
+
+// The bytes in the ring are always older than the queued pages: writers only put bytes into
+// the ring while the page queue is empty, and readers empty the ring before they take pages.
 struct Pipe {
-	u_int p_rpos;		 // read position
-	u_int p_wpos;		 // write position
-	u_char p_buf[PIPE_SIZE]; // data buffer
+	u_int p_rpos;		   // read position
+	u_int p_wpos;		   // write position
+	u_int p_prpos;		   // pages taken off the queue
+	u_int p_pwpos;		   // pages put on the queue
+	u_int p_poff;		   // bytes already read from the page at the head of the queue
+	u_int p_rseq;		   // bumped by readers whenever they make room
+	u_int p_wseq;		   // bumped by writers whenever they add data
+	u_int p_rwait;		   // a reader may be blocked on 'p_wseq'
+	u_int p_wwait;		   // a writer may be blocked on 'p_rseq'
+	u_int p_page[PIPE_NPAGES]; // bytes in each queued page, whose word keys the parked page
+	u_int p_end[2];		   // keys of the read and write end of a named pipe
+	u_char p_buf[PIPE_SIZE];   // data buffer
 };
 
+// A queued page that is read in pieces stays mapped at the page after the Pipe, in the data
+// region of the reading fd. This remembers which one it is (private to each env).
+static struct {
+	void *va;
+	u_int pos;
+} pipe_win;
+
 /* Overview:
  *   Create a pipe.
  *
@@ -115,6 +156,113 @@ static int _pipe_is_closed(struct Fd *fd, struct Pipe *p) {
 	return fd_ref == pipe_ref;
 }
 
+// Overview:
+//  Number of bytes in the ring between positions 'r' and 'w'.
+static u_int pipe_used(u_int r, u_int w) {
+	return (w + PIPE_WRAP - r) % PIPE_WRAP;
+}
+
+// Overview:
+//  Block until the peer bumps 'seq' from 'val', the pipe is closed, or PIPE_WAIT_TICKS went
+//  by. '*waiting' tells the peer to wake us up; it is set before the last check, so that the
+//  wake-up can't be missed.
+static void pipe_wait(struct Fd *fd, struct Pipe *p, u_int *waiting, u_int *seq, u_int val) {
+	*waiting = 1;
+	__sync_synchronize();
+	if (*(volatile u_int *)seq == val && !_pipe_is_closed(fd, p)) {
+		syscall_futex_wait(seq, val, PIPE_WAIT_TICKS);
+	}
+}
+
+// Overview:
+//  Bump 'seq' after we moved the pipe forward, and wake up the peers blocked on it.
+static void pipe_wake(u_int *waiting, u_int *seq) {
+	__sync_synchronize();
+	(*(volatile u_int *)seq)++;
+	__sync_synchronize();
+	if (*(volatile u_int *)waiting) {
+		*waiting = 0;
+		syscall_futex_wake(seq, 0);
+	}
+}
+
+// Overview:
+//  Return the perm of the page mapped at 'va' if it is private to us, so that it can be shared
+//  copy-on-write with the peer. Return 0 if it is not mapped, or shared (PTE_LIBRARY), or
+//  tracked for write-back (PTE_WTRACK).
+static u_int pipe_page_perm(const void *va) {
+	u_int perm;
+
+	if (!(vpd[PDX(va)] & PTE_V) || !((perm = vpt[VPN(va)]) & PTE_V)) {
+		return 0;
+	}
+	if (perm & (PTE_LIBRARY | PTE_WTRACK)) {
+		return 0;
+	}
+	return perm & 0xfff;
+}
+
+// Overview:
+//  Take at most 'n' bytes off the page at the head of the queue. A whole page read into a
+//  page-aligned buffer is mapped there copy-on-write, and nothing is copied; otherwise the
+//  page is mapped at the window of 'fd' and copied from there.
+//
+// Post-Condition:
+//  Return the number of bytes read, or the error of the page syscalls.
+static int pipe_read_page(struct Fd *fd, struct Pipe *p, void *vbuf, u_int n) {
+	u_int *slot = &p->p_page[p->p_prpos % PIPE_NPAGES];
+	u_int len = *slot, off = p->p_poff;
+	char *win = (char *)fd2data(fd) + PAGE_SIZE;
+
+	if (off == 0 && len == PAGE_SIZE && n >= PAGE_SIZE && (u_int)vbuf % PAGE_SIZE == 0 &&
+	    pipe_page_perm(vbuf) && cow_init() == 0 &&
+	    syscall_page_unpark(slot, vbuf, PTE_COW, 0) == 0) {
+		n = PAGE_SIZE;
+	} else {
+		if (pipe_win.va != win || pipe_win.pos != p->p_prpos || !pipe_page_perm(win)) {
+			try(syscall_page_unpark(slot, win, 0, 1));
+			pipe_win.va = win;
+			pipe_win.pos = p->p_prpos;
+		}
+		n = MIN(n, len - off);
+		memcpy(vbuf, win + off, n);
+		if (off + n < len) {
+			p->p_poff = off + n;
+			return n;
+		}
+		pipe_win.va = NULL;
+		syscall_mem_unmap(0, win);
+		try(syscall_page_unpark(slot, 0, 0, 0));
+	}
+	p->p_poff = 0;
+	__sync_synchronize();
+	p->p_prpos++;
+	pipe_wake(&p->p_wwait, &p->p_rseq);
+	return n;
+}
+
+// Overview:
+//  Queue the whole page at 'va', mapped with 'perm', without copying it: our mapping becomes
+//  copy-on-write, and the page is parked under its queue slot for the reader.
+//
+// Post-Condition:
+//  Return 0 on success, or the error of the page syscalls (e.g. when too many pages are
+//  parked), in which case the page isn't queued.
+static int pipe_write_page(struct Pipe *p, const void *va, u_int perm) {
+	u_int *slot = &p->p_page[p->p_pwpos % PIPE_NPAGES];
+
+	if (perm & PTE_D) {
+		try(cow_init());
+		try(syscall_mem_map(0, (void *)va, 0, (void *)va, (perm & ~PTE_D) | PTE_COW));
+	}
+	try(syscall_page_park(slot, (void *)va));
+	*slot = PAGE_SIZE;
+	__sync_synchronize();
+	p->p_pwpos++;
+	pipe_wake(&p->p_rwait, &p->p_wseq);
+	return 0;
+}
+
 /* Overview:
  *   Read at most 'n' bytes from the pipe referred by 'fd' into 'vbuf'.
  *
@@ -129,32 +277,42 @@ static int _pipe_is_closed(struct Fd *fd, struct Pipe *p) {
  *   The parameter 'offset' isn't used here.
  */
 static int pipe_read(struct Fd *fd, void *vbuf, u_int n, u_int offset) {
-	int i;
-	struct Pipe *p;
-	char *rbuf;
-
-	// Use 'fd2data' to get the 'Pipe' referred by 'fd'.
-	// Write a loop that transfers one byte in each iteration.
-	// Check if the pipe is closed by '_pipe_is_closed'.
-	// When the pipe buffer is empty:
-	//  - If at least 1 byte is read, or the pipe is closed, just return the number
-	//    of bytes read so far.
-	//  - Otherwise, keep yielding until the buffer isn't empty or the pipe is closed.
-	/* Exercise 6.1: Your code here. (2/3) */
-p = (struct Pipe*)fd2data(fd);
-	rbuf = (char *)vbuf;
-	for(i = 0;i < n;i++) {
-		while(p->p_rpos == p->p_wpos) {
-			if (_pipe_is_closed(p,fd)) {
-				return i;
-			}
-			syscall_yield();
+	struct Pipe *p = (struct Pipe *)fd2data(fd);
+	u_int r, w, i, m, seq, queued;
+
+	// Take whatever is in the ring, up to 'n' bytes, in at most two copies (the ring may
+	// wrap around). Only when the ring is empty, take from the queued pages. When there is
+	// neither, block until a writer bumps 'p_wseq'.
+	// The page queue is checked before the ring: a writer can't add bytes while pages are
+	// queued, so an empty ring then means the head page is the oldest data.
+	for (;;) {
+		seq = *(volatile u_int *)&p->p_wseq;
+		__sync_synchronize();
+		queued = *(volatile u_int *)&p->p_prpos != *(volatile u_int *)&p->p_pwpos;
+		__sync_synchronize();
+		r = p->p_rpos;
+		w = *(volatile u_int *)&p->p_wpos;
+		if (r != w) {
+			break;
 		}
-		rbuf[i]=p->p_buf[p->p_rpos%PIPE_SIZE];
-		p->p_rpos++;
+		if (queued) {
+			return pipe_read_page(fd, p, vbuf, n);
+		}
+		if (n == 0 || _pipe_is_closed(fd, p)) {
+			return 0;
+		}
+		pipe_wait(fd, p, &p->p_rwait, &p->p_wseq, seq);
 	}
+	__sync_synchronize();
+	n = MIN(n, pipe_used(r, w));
+	i = r % PIPE_SIZE;
+	m = MIN(n, PIPE_SIZE - i);
+	memcpy(vbuf, p->p_buf + i, m);
+	memcpy((char *)vbuf + m, p->p_buf, n - m);
+	__sync_synchronize();
+	p->p_rpos = (r + n) % PIPE_WRAP;
+	pipe_wake(&p->p_wwait, &p->p_rseq);
 	return n;
-	user_panic("pipe_read not implemented");
 }
 
 /* Overview:
@@ -169,38 +327,92 @@ p = (struct Pipe*)fd2data(fd);
  *   The parameter 'offset' isn't used here.
  */
 static int pipe_write(struct Fd *fd, const void *vbuf, u_int n, u_int offset) {
-	int i;
-	struct Pipe *p;
-	char *wbuf;
-
-	// Use 'fd2data' to get the 'Pipe' referred by 'fd'.
-	// Write a loop that transfers one byte in each iteration.
-	// If the bytes of the pipe used equals to 'PIPE_SIZE', the pipe is regarded as full.
-	// Check if the pipe is closed by '_pipe_is_closed'.
-	// When the pipe buffer is full:
-	//  - If the pipe is closed, just return the number of bytes written so far.
-	//  - If the pipe isn't closed, keep yielding until the buffer isn't full or the
-	//    pipe is closed.
-	/* Exercise 6.1: Your code here. (3/3) */
-p = (struct Pipe *)fd2data(fd);
-	wbuf = (char *)vbuf;
-	for(i=0;i<n;i++)
-	{
-		while((p->p_wpos-p->p_rpos)>=PIPE_SIZE)
-		{
-			if(_pipe_is_closed(fd,p))
-			{
-				return i;
+	struct Pipe *p = (struct Pipe *)fd2data(fd);
+	const char *wbuf = vbuf;
+	u_int r, w, i, m, seq, perm, done = 0;
+
+	while (done < n) {
+		const char *va = wbuf + done;
+
+		// A whole private page at a page-aligned address is queued as it is.
+		if (n - done >= PAGE_SIZE && (u_int)va % PAGE_SIZE == 0 &&
+		    (perm = pipe_page_perm(va)) != 0) {
+			while (seq = *(volatile u_int *)&p->p_rseq,
+			       p->p_pwpos - *(volatile u_int *)&p->p_prpos == PIPE_NPAGES) {
+				if (_pipe_is_closed(fd, p)) {
+					return done;
+				}
+				pipe_wait(fd, p, &p->p_wwait, &p->p_rseq, seq);
+			}
+			if (pipe_write_page(p, va, perm) == 0) {
+				done += PAGE_SIZE;
+				continue;
+			}
+		}
+
+		// Otherwise fill the free space of the ring in at most two copies, stopping at the
+		// next page boundary if whole pages follow it. Bytes may only go into the ring once
+		// the queued pages are all taken, or they would overtake them.
+		m = n - done;
+		if ((u_int)va % PAGE_SIZE != 0 && m >= PAGE_SIZE - (u_int)va % PAGE_SIZE + PAGE_SIZE) {
+			m = PAGE_SIZE - (u_int)va % PAGE_SIZE;
+		}
+		while (seq = *(volatile u_int *)&p->p_rseq,
+		       *(volatile u_int *)&p->p_prpos != p->p_pwpos ||
+			   pipe_used(*(volatile u_int *)&p->p_rpos, p->p_wpos) == PIPE_SIZE) {
+			if (_pipe_is_closed(fd, p)) {
+				return done;
 			}
-				syscall_yield();
+			pipe_wait(fd, p, &p->p_wwait, &p->p_rseq, seq);
+		}
+		__sync_synchronize();
+		r = p->p_rpos;
+		w = p->p_wpos;
+		m = MIN(m, PIPE_SIZE - pipe_used(r, w));
+		i = w % PIPE_SIZE;
+		memcpy(p->p_buf + i, va, MIN(m, PIPE_SIZE - i));
+		if (m > PIPE_SIZE - i) {
+			memcpy(p->p_buf, va + PIPE_SIZE - i, m - (PIPE_SIZE - i));
 		}
-		p->p_buf[p->p_wpos%PIPE_SIZE]=wbuf[i];
-		p->p_wpos++;
+		__sync_synchronize();
+		p->p_wpos = (w + m) % PIPE_WRAP;
+		pipe_wake(&p->p_rwait, &p->p_wseq);
+		done += m;
 	}
 	return n;
-	user_panic("pipe_write not implemented");
+}
 
-	return n;
+// Overview:
+//  Report POLLIN if there is data (bytes or queued pages), POLLOUT if there is room for
+//  bytes, and POLLHUP once the other end is closed. When nothing asked for is ready, 'poll'
+//  blocks on the sequence word the peer bumps, the same way 'pipe_wait' does.
+static int pipe_poll(struct Fd *fd, int events, struct Pollwait *pw) {
+	struct Pipe *p = (struct Pipe *)fd2data(fd);
+	u_int rseq = *(volatile u_int *)&p->p_rseq;
+	u_int wseq = *(volatile u_int *)&p->p_wseq;
+	int revents = 0;
+
+	__sync_synchronize();
+	if (_pipe_is_closed(fd, p)) {
+		return POLLHUP | (events & POLLIN);
+	}
+	if (p->p_rpos != p->p_wpos || p->p_prpos != p->p_pwpos) {
+		revents |= events & POLLIN;
+	}
+	if (p->p_prpos == p->p_pwpos && pipe_used(p->p_rpos, p->p_wpos) < PIPE_SIZE) {
+		revents |= events & POLLOUT;
+	}
+	if (revents == 0 && pw != NULL) {
+		if (events & POLLIN) {
+			p->p_rwait = 1;
+			poll_wait(pw, &p->p_wseq, wseq);
+		}
+		if (events & POLLOUT) {
+			p->p_wwait = 1;
+			poll_wait(pw, &p->p_rseq, rseq);
+		}
+	}
+	return revents;
 }
 
 /* Overview:
@@ -229,6 +441,73 @@ int pipe_is_closed(int fdnum) {
 	return _pipe_is_closed(fd, p);
 }
 
+// Overview:
+//  Make 'fd', just opened by 'open' on the named pipe 'fileid', an end of that pipe. The file
+//  server keeps the Pipe page of each named pipe and maps it for us. The Fd page of each end
+//  is parked under 'p_end' by the first env to open that end, and every env opening it maps
+//  the same page, so that 'pageref' counts the ends as it does for 'pipe'. The parked Fd
+//  pages and the Pipe page parked by the server hold one reference each, which cancel out
+//  in '_pipe_is_closed'. Like a POSIX FIFO, block until the other end is open too.
+//
+// Post-Condition:
+//  Return the fd number on success.
+//  Return -E_INVAL if 'mode' is O_RDWR, or the error of the file server or of the page
+//  syscalls; 'fd' is freed then.
+int fifo_open(struct Fd *fd, u_int fileid, int mode) {
+	struct Pipe *p = (struct Pipe *)fd2data(fd);
+	u_int end, seq, *waiting, *peerseq;
+	int r;
+
+	if ((mode & O_ACCMODE) == O_RDWR) {
+		syscall_mem_unmap(0, fd);
+		return -E_INVAL;
+	}
+	end = (mode & O_ACCMODE) == O_WRONLY;
+	if ((r = fsipc_fifo(fileid, p)) < 0) {
+		syscall_mem_unmap(0, fd);
+		return r;
+	}
+	// The file server reuses the Filefd once nobody maps it.
+	syscall_mem_unmap(0, fd);
+
+	// Map the Fd page of our end, or make it if that end was never opened. Another env may
+	// park one before us, then we take theirs.
+	while ((r = syscall_page_unpark(&p->p_end[end], fd, PTE_D | PTE_LIBRARY, 1)) < 0) {
+		if (r != -E_NOT_FOUND || (r = syscall_mem_alloc(0, fd, PTE_D | PTE_LIBRARY)) < 0) {
+			goto err;
+		}
+		fd->fd_dev_id = devpipe.dev_id;
+		fd->fd_omode = end ? O_WRONLY : O_RDONLY;
+		if ((r = syscall_page_park(&p->p_end[end], fd)) == 0) {
+			break;
+		}
+		syscall_mem_unmap(0, fd);
+		if (r != -E_INVAL) {
+			goto err;
+		}
+	}
+
+	// Wake up the envs blocked here on the other end, then wait for one ourselves.
+	pipe_wake(&p->p_rwait, &p->p_wseq);
+	pipe_wake(&p->p_wwait, &p->p_rseq);
+	waiting = end ? &p->p_wwait : &p->p_rwait;
+	peerseq = end ? &p->p_rseq : &p->p_wseq;
+	for (;;) {
+		seq = *(volatile u_int *)peerseq;
+		*waiting = 1;
+		__sync_synchronize();
+		if (!_pipe_is_closed(fd, p)) {
+			break;
+		}
+		syscall_futex_wait(peerseq, seq, PIPE_WAIT_TICKS);
+	}
+	return fd2num(fd);
+
+err:
+	syscall_mem_unmap(0, p);
+	return r;
+}
+
 /* Overview:
  *   Close the pipe referred by 'fd'.
  *
@@ -239,9 +518,20 @@ int pipe_is_closed(int fdnum) {
  *   Use 'syscall_mem_unmap' to unmap the pages.
  */
 static int pipe_close(struct Fd *fd) {
-	// Unmap 'fd' and the referred Pipe.
+	struct Pipe *p = (struct Pipe *)fd2data(fd);
+
+	// Unmap 'fd', the window and the referred Pipe. The peers blocked on the pipe have to
+	// check it again, as it may be closed now. Pages still queued are dropped by the kernel
+	// along with the Pipe page.
 	syscall_mem_unmap(0, fd);
-	syscall_mem_unmap(0, (void *)fd2data(fd));
+	if (pipe_win.va == (char *)p + PAGE_SIZE) {
+		pipe_win.va = NULL;
+	}
+	syscall_mem_unmap(0, (char *)p + PAGE_SIZE);
+	p->p_rwait = p->p_wwait = 0;
+	syscall_futex_wake(&p->p_rseq, 0);
+	syscall_futex_wake(&p->p_wseq, 0);
+	syscall_mem_unmap(0, p);
 	return 0;
 }
 
@@ -111,6 +111,7 @@ int spawn(char *prog, char **argv) {
 	// Step 1: Open the file 'prog' (the path of the program).
 	// Return the error if 'open' fails.
 	int fd;
+	fflush(NULL);
 	int len = strlen(prog);
 	if ((fd = open(prog, O_RDONLY)) < 0) {
 		if (fd == -E_NOT_FOUND && (len < 2 || prog[len - 1] != 'b' || prog[len - 2] != '.')) {
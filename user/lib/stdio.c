@@ -0,0 +1,295 @@
+#include <lib.h>
+#include <print.h>
+
+// Stream flags.
+#define STREAM_USED 0x1	   // slot in '__iob' is taken
+#define STREAM_EOF 0x2	   // end of file seen on read
+#define STREAM_ERR 0x4	   // an underlying read or write failed
+#define STREAM_READING 0x8 // 'buf' holds read-ahead data
+#define STREAM_WRITING 0x10 // 'buf' holds pending output
+
+#define STREAM_MODE_UNSET (-1)
+
+FILE __iob[FOPEN_MAX] = {
+    [0] = {.fd = 0, .mode = STREAM_MODE_UNSET, .flags = STREAM_USED},
+    [1] = {.fd = 1, .mode = STREAM_MODE_UNSET, .flags = STREAM_USED},
+    [2] = {.fd = 2, .mode = _IONBF, .flags = STREAM_USED},
+};
+
+// Overview:
+//  Pick the buffering mode of a stream on its first use: line buffered when it is
+//  attached to the console, fully buffered otherwise.
+static int stream_mode(FILE *fp) {
+	if (fp->mode == STREAM_MODE_UNSET) {
+		fp->mode = iscons(fp->fd) > 0 ? _IOLBF : _IOFBF;
+	}
+	return fp->mode;
+}
+
+// Overview:
+//  Find the stream bound to file descriptor 'fd'.
+//
+// Post-Condition:
+//  Return the stream, or NULL if 'fd' has no stream.
+FILE *stream_lookup(int fd) {
+	for (int i = 0; i < FOPEN_MAX; i++) {
+		if ((__iob[i].flags & STREAM_USED) && __iob[i].fd == fd) {
+			return &__iob[i];
+		}
+	}
+	return NULL;
+}
+
+// Overview:
+//  Wrap an open file descriptor in a buffered stream. 'mode' is one of the 'fopen' modes
+//  ("r", "w", "a", optionally with "+" or "b"); it must agree with how 'fd' was opened, and
+//  changes nothing on 'fd' itself.
+//
+// Post-Condition:
+//  Return the stream, or NULL if 'mode' is not valid or all FOPEN_MAX streams are in use.
+FILE *fdopen(int fd, const char *mode) {
+	FILE *fp;
+
+	if (mode == NULL || mode[0] == '\0' || strchr("rwa", mode[0]) == NULL) {
+		return NULL;
+	}
+	if ((fp = stream_lookup(fd)) != NULL) {
+		return fp;
+	}
+	for (int i = 0; i < FOPEN_MAX; i++) {
+		fp = &__iob[i];
+		if (!(fp->flags & STREAM_USED)) {
+			fp->fd = fd;
+			fp->mode = STREAM_MODE_UNSET;
+			fp->flags = STREAM_USED;
+			fp->pos = 0;
+			fp->len = 0;
+			return fp;
+		}
+	}
+	return NULL;
+}
+
+// Overview:
+//  Called by 'close' before 'fd' is closed: flush the stream bound to it and release it, so
+//  that buffered output doesn't go to the next file given 'fd'. The standard streams stay
+//  bound to 0, 1 and 2, back in their initial state, for whatever is given them next.
+void stream_close(int fd) {
+	FILE *fp;
+
+	if ((fp = stream_lookup(fd)) == NULL) {
+		return;
+	}
+	fflush(fp);
+	fp->pos = fp->len = 0;
+	if (fp == stdin || fp == stdout || fp == stderr) {
+		fp->mode = fp == stderr ? _IONBF : STREAM_MODE_UNSET;
+		fp->flags = STREAM_USED;
+	} else {
+		fp->flags = 0;
+	}
+}
+
+// Overview:
+//  Flush 'fp', release it and close its file descriptor.
+int fclose(FILE *fp) {
+	int r = fflush(fp);
+
+	fp->flags = 0;
+	if (close(fp->fd) < 0) {
+		return EOF;
+	}
+	return r;
+}
+
+// Overview:
+//  Set the buffering mode of 'fp' to one of _IOFBF, _IOLBF or _IONBF.
+//  Any pending output is flushed first.
+int setvbuf(FILE *fp, int mode) {
+	if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+		return -E_INVAL;
+	}
+	fflush(fp);
+	fp->mode = mode;
+	return 0;
+}
+
+// Overview:
+//  Write out the pending output of 'fp', or drop its read-ahead data. A file is seeked back
+//  over the bytes read ahead but not consumed, so that the next write, or whoever uses the
+//  descriptor next, starts where the program stopped reading. On a pipe or the console they
+//  are lost.
+static int stream_flush(FILE *fp) {
+	struct Fd *fd;
+	u_int off = 0;
+	int r;
+
+	if (fp->flags & STREAM_READING) {
+		if (fp->len > fp->pos && fd_lookup(fp->fd, &fd) == 0 &&
+		    fd->fd_dev_id == devfile.dev_id) {
+			seek(fp->fd, fd->fd_offset - (fp->len - fp->pos));
+		}
+		fp->flags &= ~STREAM_READING;
+		fp->pos = fp->len = 0;
+		return 0;
+	}
+	while (off < fp->pos) {
+		if ((r = write(fp->fd, fp->buf + off, fp->pos - off)) <= 0) {
+			fp->flags |= STREAM_ERR;
+			fp->pos = 0;
+			return EOF;
+		}
+		off += r;
+	}
+	fp->pos = 0;
+	fp->flags &= ~STREAM_WRITING;
+	return 0;
+}
+
+// Overview:
+//  Write out the pending output of 'fp', or of every stream if 'fp' is NULL. The read-ahead
+//  of an input stream 'fp' is given back (see 'stream_flush').
+//
+// Post-Condition:
+//  Return 0 on success, EOF if any write failed.
+int fflush(FILE *fp) {
+	int r = 0;
+
+	if (fp != NULL) {
+		return (fp->flags & (STREAM_WRITING | STREAM_READING)) ? stream_flush(fp) : 0;
+	}
+	for (int i = 0; i < FOPEN_MAX; i++) {
+		if ((__iob[i].flags & (STREAM_USED | STREAM_WRITING)) ==
+		    (STREAM_USED | STREAM_WRITING)) {
+			if (stream_flush(&__iob[i]) < 0) {
+				r = EOF;
+			}
+		}
+	}
+	return r;
+}
+
+// Overview:
+//  Append 'n' bytes to the output buffer of 'fp', flushing as the buffering mode requires.
+//
+// Post-Condition:
+//  Return 'n' on success, or a negative value if the stream is in error.
+int stream_write(FILE *fp, const char *s, u_int n) {
+	int mode = stream_mode(fp);
+	int newline = 0;
+	u_int done = 0;
+
+	if (fp->flags & STREAM_READING) {
+		stream_flush(fp);
+	}
+	if (mode == _IONBF) {
+		while (done < n) {
+			int r = write(fp->fd, s + done, n - done);
+			if (r <= 0) {
+				fp->flags |= STREAM_ERR;
+				return r < 0 ? r : EOF;
+			}
+			done += r;
+		}
+		return n;
+	}
+
+	fp->flags |= STREAM_WRITING;
+	while (done < n) {
+		u_int m = MIN(n - done, (u_int)BUFSIZ - fp->pos);
+		memcpy(fp->buf + fp->pos, s + done, m);
+		for (u_int i = 0; i < m && !newline; i++) {
+			newline = s[done + i] == '\n';
+		}
+		fp->pos += m;
+		done += m;
+		if (fp->pos == BUFSIZ && stream_flush(fp) < 0) {
+			return EOF;
+		}
+	}
+	if (mode == _IOLBF && newline && stream_flush(fp) < 0) {
+		return EOF;
+	}
+	return n;
+}
+
+int fputc(int c, FILE *fp) {
+	char ch = c;
+	if (stream_write(fp, &ch, 1) != 1) {
+		return EOF;
+	}
+	return (u_char)ch;
+}
+
+int putchar(int c) {
+	return fputc(c, stdout);
+}
+
+int fputs(const char *s, FILE *fp) {
+	u_int n = strlen(s);
+	return stream_write(fp, s, n) == n ? 0 : EOF;
+}
+
+// Overview:
+//  Refill the read buffer of 'fp' with a single 'read'. Pending output on the standard
+//  output is flushed before we may block on the console, so that prompts are visible.
+static int stream_fill(FILE *fp) {
+	int r;
+
+	if (fp->flags & STREAM_WRITING) {
+		stream_flush(fp);
+	}
+	if (stream_mode(fp) == _IOLBF) {
+		fflush(stdout);
+	}
+	if ((r = read(fp->fd, fp->buf, BUFSIZ)) <= 0) {
+		fp->flags |= r < 0 ? STREAM_ERR : STREAM_EOF;
+		return EOF;
+	}
+	fp->flags |= STREAM_READING;
+	fp->pos = 0;
+	fp->len = r;
+	return 0;
+}
+
+int fgetc(FILE *fp) {
+	if (!(fp->flags & STREAM_READING) || fp->pos == fp->len) {
+		if (stream_fill(fp) < 0) {
+			return EOF;
+		}
+	}
+	return (u_char)fp->buf[fp->pos++];
+}
+
+int getchar(void) {
+	return fgetc(stdin);
+}
+
+// Overview:
+//  Read at most 'n' - 1 bytes into 's', stopping after a newline. 's' is null-terminated.
+//
+// Post-Condition:
+//  Return 's', or NULL if end of file (or an error) came before any byte was read.
+char *fgets(char *s, int n, FILE *fp) {
+	int i, c = 0;
+
+	for (i = 0; i < n - 1 && c != '\n'; i++) {
+		if ((c = fgetc(fp)) == EOF) {
+			break;
+		}
+		s[i] = c;
+	}
+	if (i == 0 && n > 1) {
+		return NULL;
+	}
+	s[i] = '\0';
+	return s;
+}
+
+int feof(FILE *fp) {
+	return (fp->flags & STREAM_EOF) != 0;
+}
+
+int ferror(FILE *fp) {
+	return (fp->flags & STREAM_ERR) != 0;
+}
@@ -4,11 +4,27 @@
 #include <syscall.h>
 #include <trap.h>
 
+// Overview:
+//  Touch the pages of the syscall buffer ['va', 'va' + 'len') that lie in the fd data region,
+//  so that the pages of an open file among them are mapped by 'file_fault_entry' first. The
+//  kernel can't run that handler for its own accesses, and fails them with -E_FAULT instead.
+static void prefault(const void *va, u_int len) {
+	u_int end = MIN((u_int)va + len, INDEX2DATA(MAXFD));
+
+	if ((u_int)va + len < (u_int)va) {
+		return;
+	}
+	for (u_int p = MAX(ROUNDDOWN(va, PAGE_SIZE), FILEBASE); p < end; p += PAGE_SIZE) {
+		(void)*(volatile const char *)p;
+	}
+}
+
 void syscall_putchar(int ch) {
 	msyscall(SYS_putchar, ch);
 }
 
 int syscall_print_cons(const void *str, u_int num) {
+	prefault(str, num);
 	return msyscall(SYS_print_cons, str, num);
 }
 
@@ -28,6 +44,11 @@ int syscall_set_tlb_mod_entry(u_int envid, void (*func)(struct Trapframe *)) {
 	return msyscall(SYS_set_tlb_mod_entry, envid, func);
 }
 
+int syscall_set_pgfault_entry(u_int envid, void (*func)(struct Trapframe *), u_int start,
+			      u_int end) {
+	return msyscall(SYS_set_pgfault_entry, envid, func, start, end);
+}
+
 int syscall_mem_alloc(u_int envid, void *va, u_int perm) {
 	return msyscall(SYS_mem_alloc, envid, va, perm);
 }
@@ -45,6 +66,7 @@ int syscall_set_env_status(u_int envid, u_int status) {
 }
 
 int syscall_set_trapframe(u_int envid, struct Trapframe *tf) {
+	prefault(tf, sizeof *tf);
 	return msyscall(SYS_set_trapframe, envid, tf);
 }
 
@@ -67,11 +89,13 @@ int syscall_cgetc() {
 
 int syscall_write_dev(void *va, u_int dev, u_int size) {
 	/* Exercise 5.2: Your code here. (1/2) */
+	prefault(va, size);
 	return msyscall(SYS_write_dev, va, dev, size);
 }
 
 int syscall_read_dev(void *va, u_int dev, u_int size) {
 	/* Exercise 5.2: Your code here. (2/2) */
+	prefault(va, size);
 	return msyscall(SYS_read_dev, va, dev, size);
 }
 
@@ -93,4 +117,46 @@ int syscall_add_job(u_int envid, char * cmd) {
 
 int syscall_done_job(u_int envid) {
 	return msyscall(SYS_done_job, envid);
-}
\ No newline at end of file
+}
+
+int syscall_read_klog(void *buf, u_int len, u_int *offset) {
+	prefault(buf, len);
+	prefault(offset, sizeof *offset);
+	return msyscall(SYS_read_klog, buf, len, offset);
+}
+
+int syscall_clock_gettime(u_int clock, uint64_t *time) {
+	prefault(time, sizeof *time);
+	return msyscall(SYS_clock_gettime, clock, time);
+}
+
+int syscall_ipc_recv_pages(void *dstva, u_int npages) {
+	return msyscall(SYS_ipc_recv_pages, dstva, npages);
+}
+
+int syscall_ipc_try_send_pages(u_int envid, u_int value, void *const *srcvas, u_int npages,
+			       u_int perm) {
+	prefault(srcvas, npages * sizeof *srcvas);
+	return msyscall(SYS_ipc_try_send_pages, envid, value, srcvas, npages, perm);
+}
+
+int syscall_futex_wait(u_int *va, u_int val, u_int ticks) {
+	return msyscall(SYS_futex_wait, va, val, ticks);
+}
+
+int syscall_futex_wake(u_int *va, u_int n) {
+	return msyscall(SYS_futex_wake, va, n);
+}
+
+int syscall_futex_waitv(struct WaitKey *keys, u_int n, u_int ticks) {
+	prefault(keys, n * sizeof *keys);
+	return msyscall(SYS_futex_waitv, keys, n, ticks);
+}
+
+int syscall_page_park(u_int *key, void *srcva) {
+	return msyscall(SYS_page_park, key, srcva);
+}
+
+int syscall_page_unpark(u_int *key, void *dstva, u_int perm, u_int keep) {
+	return msyscall(SYS_page_unpark, key, dstva, perm, keep);
+}
@@ -2,9 +2,16 @@
 #include <lib.h>
 void wait(u_int envid) {
 	const volatile struct Env *e;
+	struct WaitKey wk[2];
 
+	// The kernel wakes up the waiters on 'env_status' when it frees the env; until then,
+	// block in the kernel rather than yield. Wait on 'env_id' as well: if the env exits and
+	// its slot is reused before we block, the new env's status may match what we saw, but
+	// its id can't, so the wait returns at once instead of waiting for that env.
 	e = &envs[ENVX(envid)];
-	while (e->env_id == envid && e->env_status != ENV_FREE) {
-		syscall_yield();
+	wk[0].wk_va = (u_int)&e->env_id;
+	wk[1].wk_va = (u_int)&e->env_status;
+	while ((wk[0].wk_val = e->env_id) == envid && (wk[1].wk_val = e->env_status) != ENV_FREE) {
+		syscall_futex_waitv(wk, 2, 0);
 	}
 }
@@ -4,7 +4,7 @@ int main(int argc, char **argv) {
     int r;
     // printf("%s man! What can I say !!!", argv[1]);
     if (strcmp(argv[1], "-p") == 0) {
-        if (!((r = open(argv[2], O_RDONLY)) < 0)) {
+        if (!((r = open(argv[2], O_RDONLY | O_STAT)) < 0)) {
             return -1;
         }
         if ((r = create(argv[2], FTYPE_DIR)) < 0) {
@@ -20,7 +20,7 @@ int main(int argc, char **argv) {
             create(p, FTYPE_DIR);
         }
     } else {
-        if (!((r = open(argv[1], O_RDONLY)) < 0)) {
+        if (!((r = open(argv[1], O_RDONLY | O_STAT)) < 0)) {
             fprintf(1, "mkdir: cannot create directory '%s': File exists\n", argv[1]);
             return -1;
         }
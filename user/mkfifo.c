@@ -0,0 +1,17 @@
+#include <lib.h>
+
+int main(int argc, char **argv) {
+	int r, status = 0;
+
+	if (argc < 2) {
+		printf("usage: mkfifo path...\n");
+		return 1;
+	}
+	for (int i = 1; i < argc; i++) {
+		if ((r = mkfifo(argv[i])) < 0) {
+			printf("mkfifo: cannot create fifo '%s': %d\n", argv[i], r);
+			status = 1;
+		}
+	}
+	return status;
+}
@@ -3,41 +3,42 @@
 int bol = 1;
 int line = 0;
 
-void num(int f, const char *s) {
-	long n;
-	int r;
-	char c;
+void num(FILE *f, const char *s) {
+	int c;
 
-	while ((n = read(f, &c, 1)) > 0) {
+	while ((c = getc(f)) != EOF) {
 		if (bol) {
 			printf("%5d ", ++line);
 			bol = 0;
 		}
-		if ((r = printf("%c", c)) != 1) {
-			user_panic("write error copying %s: %d", s, r);
+		if (putchar(c) != c) {
+			user_panic("write error copying %s", s);
 		}
 		if (c == '\n') {
 			bol = 1;
 		}
 	}
-	if (n < 0) {
-		user_panic("error reading %s: %d", s, n);
+	if (ferror(f)) {
+		user_panic("error reading %s", s);
 	}
 }
 
 int main(int argc, char **argv) {
 	int f, i;
+	FILE *fp;
 
 	if (argc == 1) {
-		num(0, "<stdin>");
+		num(stdin, "<stdin>");
 	} else {
 		for (i = 1; i < argc; i++) {
 			f = open(argv[i], O_RDONLY);
 			if (f < 0) {
 				user_panic("can't open %s: %d", argv[i], f);
+			} else if ((fp = fdopen(f, "r")) == NULL) {
+				user_panic("can't open a stream for %s", argv[i]);
 			} else {
-				num(f, argv[i]);
-				close(f);
+				num(fp, argv[i]);
+				fclose(fp);
 			}
 		}
 	}
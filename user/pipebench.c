@@ -0,0 +1,75 @@
+#include <lib.h>
+
+// Pipe throughput: a child writes 'kb' KiB into a pipe in chunks of 'chunk' bytes, and the
+// parent reads them back with reads of the same size. Reports the cycles and the context
+// switches (env runs) both ends needed.
+// Both buffers start 'off' bytes into a page: with 0 and chunks of whole pages, the pages are
+// handed over without copying; any other offset makes everything go through the ring.
+
+#define MAXCHUNK 8192
+
+char wbuf[MAXCHUNK + PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+char rbuf[MAXCHUNK + PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static u_int cycles_since(uint64_t start) {
+	uint64_t now;
+
+	syscall_clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u_int)(now - start);
+}
+
+static u_int parse(char *s) {
+	u_int n = 0;
+
+	for (; *s >= '0' && *s <= '9'; s++) {
+		n = n * 10 + *s - '0';
+	}
+	return n;
+}
+
+int main(int argc, char **argv) {
+	u_int kb = argc > 1 ? parse(argv[1]) : 1024;
+	u_int chunk = argc > 2 ? parse(argv[2]) : 4096;
+	u_int off = argc > 3 ? parse(argv[3]) % PAGE_SIZE : 0;
+	u_int total = 0, runs;
+	uint64_t start;
+	int p[2], r, child;
+
+	if (kb == 0 || chunk == 0 || chunk > MAXCHUNK) {
+		printf("usage: pipebench [KiB] [chunk (1-%d)] [offset]\n", MAXCHUNK);
+		return 1;
+	}
+	if ((r = pipe(p)) < 0) {
+		printf("pipebench: pipe: %d\n", r);
+		return 1;
+	}
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((child = fork()) < 0) {
+		printf("pipebench: fork: %d\n", child);
+		return 1;
+	}
+	if (child == 0) {
+		close(p[0]);
+		runs = env->env_runs;
+		for (u_int left = kb * 1024; left > 0; left -= MIN(left, chunk)) {
+			if ((r = write(p[1], wbuf + off, MIN(left, chunk))) < 0) {
+				printf("pipebench: write: %d\n", r);
+				exit(1);
+			}
+		}
+		close(p[1]);
+		printf("writer: %u runs\n", env->env_runs - runs);
+		exit(0);
+	}
+	close(p[1]);
+	runs = env->env_runs;
+	while ((r = read(p[0], rbuf + off, chunk)) > 0) {
+		total += r;
+	}
+	u_int cycles = cycles_since(start);
+	printf("reader: %u runs\n", env->env_runs - runs);
+	close(p[0]);
+	wait(child);
+	printf("%u bytes in %u-byte chunks at offset %u, %u cycles\n", total, chunk, off, cycles);
+	return 0;
+}
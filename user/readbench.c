@@ -0,0 +1,41 @@
+#include <lib.h>
+
+// Sequential read throughput: time open() (which maps the whole file through the file
+// server) and one pass of reads over it, and report the block cache counters around it.
+
+char buf[BLOCK_SIZE];
+
+static u_int cycles_since(uint64_t start) {
+	uint64_t now;
+
+	syscall_clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u_int)(now - start);
+}
+
+int main(int argc, char **argv) {
+	struct BlockCacheStat before, after;
+	uint64_t start;
+	u_int open_cycles, total = 0;
+	int fd, n;
+	char *path = argc > 1 ? argv[1] : "/sh.b";
+
+	fsipc_cache_stat(&before);
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		printf("readbench: open %s: %d\n", path, fd);
+		return 1;
+	}
+	open_cycles = cycles_since(start);
+	while ((n = read(fd, buf, sizeof buf)) > 0) {
+		total += n;
+	}
+	u_int read_cycles = cycles_since(start) - open_cycles;
+	close(fd);
+	fsipc_cache_stat(&after);
+
+	printf("%s: %u bytes, open %u cycles, read %u cycles\n", path, total, open_cycles,
+	       read_cycles);
+	printf("misses %u readahead %u hits %u\n", after.bc_misses - before.bc_misses,
+	       after.bc_readahead - before.bc_readahead, after.bc_hits - before.bc_hits);
+	return 0;
+}
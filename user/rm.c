@@ -5,7 +5,7 @@ int main(int argc, char **argv) {
 	struct Filefd *ffd;
     int r;
     if (strcmp(argv[1], "-r") == 0) {
-        if ((r = open(argv[2], O_RDONLY)) < 0) {
+        if ((r = open(argv[2], O_RDONLY | O_STAT)) < 0) {
             fprintf(1, "rm: cannot remove '%s': No such file or directory\n", argv[2]);
             return -1;
         }
@@ -13,14 +13,14 @@ int main(int argc, char **argv) {
             return -1;
         }
     } else if (strcmp(argv[1], "-rf") == 0) {
-        if ((r = open(argv[2], O_RDONLY)) < 0) {
+        if ((r = open(argv[2], O_RDONLY | O_STAT)) < 0) {
             return -1;
         }
         if ((r = remove(argv[2])) < 0) {
             return -1;
         }
     } else {
-        if ((r = open(argv[1], O_RDONLY)) < 0) {
+        if ((r = open(argv[1], O_RDONLY | O_STAT)) < 0) {
             fprintf(1, "rm: cannot remove '%s': No such file or directory\n", argv[1]);
             return -1;
         }
@@ -0,0 +1,63 @@
+#include <lib.h>
+
+// Write a file larger than the block cache of the file server, then read it back twice: with
+// 'read', and through the pages its fd maps. The server can only evict the blocks that no
+// client maps, so both passes rely on the client giving its pages back.
+
+#define PATH "/bigfile"
+#define NPAGES 768 // 3 MiB, while the cache holds 512 blocks
+
+static u_int page[PAGE_SIZE / 4];
+
+static void fill(u_int pg) {
+	for (u_int i = 0; i < PAGE_SIZE / 4; i++) {
+		page[i] = pg << 16 | i;
+	}
+}
+
+static void check(u_int pg, const u_int *p) {
+	for (u_int i = 0; i < PAGE_SIZE / 4; i++) {
+		if (p[i] != (pg << 16 | i)) {
+			user_panic("page %d, word %d: %08x", pg, i, p[i]);
+		}
+	}
+}
+
+int main() {
+	void *blk;
+	int fd, r;
+
+	if ((fd = open(PATH, O_RDWR | O_CREAT | O_TRUNC)) < 0) {
+		user_panic("open %s: %d", PATH, fd);
+	}
+	for (u_int pg = 0; pg < NPAGES; pg++) {
+		fill(pg);
+		if ((r = write(fd, page, PAGE_SIZE)) != PAGE_SIZE) {
+			user_panic("write page %d: %d", pg, r);
+		}
+	}
+	close(fd);
+
+	if ((fd = open(PATH, O_RDONLY)) < 0) {
+		user_panic("open %s: %d", PATH, fd);
+	}
+	for (u_int pg = 0; pg < NPAGES; pg++) {
+		if ((r = readn(fd, page, PAGE_SIZE)) != PAGE_SIZE) {
+			user_panic("read page %d: %d", pg, r);
+		}
+		check(pg, page);
+	}
+	for (u_int pg = 0; pg < NPAGES; pg++) {
+		if ((r = read_map(fd, pg * PAGE_SIZE, &blk)) < 0) {
+			user_panic("read_map page %d: %d", pg, r);
+		}
+		check(pg, blk);
+	}
+	close(fd);
+
+	if ((r = remove(PATH)) < 0) {
+		user_panic("remove %s: %d", PATH, r);
+	}
+	printf("testbigfile: ok\n");
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <lib.h>
+
+// Two children that share no fd talk through a named pipe: the writer opens it after the
+// reader is already blocked in 'open', and both see the other end come and go.
+
+#define FIFO "/testfifo"
+#define ROUNDS 16
+
+static char page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static void writer(void) {
+	int fd, r;
+
+	if ((fd = open(FIFO, O_WRONLY)) < 0) {
+		user_panic("open for writing: %d", fd);
+	}
+	for (int i = 0; i < ROUNDS; i++) {
+		memset(page, 'a' + i, sizeof page);
+		if ((r = write(fd, page, i % 2 ? sizeof page : 100)) < 0) {
+			user_panic("write: %d", r);
+		}
+	}
+	close(fd);
+	exit(0);
+}
+
+static void reader(void) {
+	char buf[512];
+	u_int total = 0, want = 0;
+	int fd, n;
+
+	if ((fd = open(FIFO, O_RDONLY)) < 0) {
+		user_panic("open for reading: %d", fd);
+	}
+	for (int i = 0; i < ROUNDS; i++) {
+		want += i % 2 ? PAGE_SIZE : 100;
+	}
+	while ((n = read(fd, buf, sizeof buf)) > 0) {
+		total += n;
+	}
+	if (n < 0 || total != want) {
+		user_panic("read %d bytes out of %d (last read %d)", total, want, n);
+	}
+	close(fd);
+	exit(0);
+}
+
+int main() {
+	int r, rd, wr;
+
+	if ((r = mkfifo(FIFO)) < 0 && r != -E_FILE_EXISTS) {
+		user_panic("mkfifo: %d", r);
+	}
+	for (int round = 0; round < 2; round++) {
+		if ((rd = fork()) == 0) {
+			reader();
+		}
+		syscall_futex_waitv(NULL, 0, 5);
+		if ((wr = fork()) == 0) {
+			writer();
+		}
+		if (rd < 0 || wr < 0) {
+			user_panic("fork: %d %d", rd, wr);
+		}
+		wait(rd);
+		wait(wr);
+	}
+	remove(FIFO);
+	printf("testfifo: ok\n");
+	return 0;
+}
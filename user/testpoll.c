@@ -0,0 +1,74 @@
+#include <lib.h>
+
+// Two children write into two pipes at different paces; the parent multiplexes them (and the
+// console) with one poll loop, then checks that an idle pipe times out.
+
+static void writer(int fd, char *msg, int rounds, int ticks) {
+	for (int i = 0; i < rounds; i++) {
+		syscall_futex_waitv(NULL, 0, ticks);
+		if (write(fd, msg, strlen(msg)) < 0) {
+			user_panic("write");
+		}
+	}
+	exit(0);
+}
+
+int main() {
+	struct pollfd fds[3];
+	char buf[64];
+	int p[2][2], open = 2, r;
+
+	for (int i = 0; i < 2; i++) {
+		if ((r = pipe(p[i])) < 0) {
+			user_panic("pipe: %d", r);
+		}
+		if ((r = fork()) < 0) {
+			user_panic("fork: %d", r);
+		}
+		if (r == 0) {
+			close(p[i][0]);
+			writer(p[i][1], i == 0 ? "fast " : "slow ", i == 0 ? 6 : 3, i == 0 ? 2 : 5);
+		}
+		close(p[i][1]);
+		fds[i].fd = p[i][0];
+		fds[i].events = POLLIN;
+	}
+	fds[2].fd = 0;
+	fds[2].events = iscons(0) > 0 ? POLLIN : 0;
+
+	while (open > 0) {
+		if ((r = poll(fds, 3, -1)) <= 0) {
+			user_panic("poll: %d", r);
+		}
+		for (int i = 0; i < 2; i++) {
+			if (fds[i].revents & POLLIN) {
+				if ((r = read(fds[i].fd, buf, sizeof buf - 1)) > 0) {
+					buf[r] = 0;
+					debugf("pipe %d: %s\n", i, buf);
+					continue;
+				}
+			}
+			if (fds[i].revents & POLLHUP) {
+				debugf("pipe %d: closed\n", i);
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				open--;
+			}
+		}
+		if (fds[2].revents & POLLIN) {
+			read(0, buf, 1);
+			debugf("console: %c\n", buf[0]);
+		}
+	}
+
+	if ((r = pipe(p[0])) < 0) {
+		user_panic("pipe: %d", r);
+	}
+	fds[0].fd = p[0][0];
+	fds[0].events = POLLIN;
+	if ((r = poll(fds, 1, 5)) != 0) {
+		user_panic("poll on an idle pipe returned %d", r);
+	}
+	debugf("poll timed out properly\n");
+	return 0;
+}
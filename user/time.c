@@ -0,0 +1,37 @@
+#include <lib.h>
+
+// There is no 64-bit division in our freestanding libraries, so large values go out in hex.
+static void print_cycles(const char *name, uint64_t t) {
+	if (t >> 32) {
+		printf("%s\t0x%x%08x cycles\n", name, (u_int)(t >> 32), (u_int)t);
+	} else {
+		printf("%s\t%u cycles\n", name, (u_int)t);
+	}
+}
+
+int main(int argc, char **argv) {
+	const volatile struct Env *e;
+	uint64_t start, end;
+	int child;
+
+	if (argc < 2) {
+		printf("usage: time command [args...]\n");
+		return 1;
+	}
+	syscall_clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((child = spawn(argv[1], argv + 1)) < 0) {
+		printf("time: spawn %s: %d\n", argv[1], child);
+		return 1;
+	}
+	wait(child);
+	syscall_clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// The slot of an exited env keeps its counters until it is allocated again.
+	e = &envs[ENVX(child)];
+	print_cycles("real", end - start);
+	if (e->env_id == child) {
+		print_cycles("user", e->env_utime);
+		print_cycles("sys", e->env_stime);
+	}
+	return 0;
+}
@@ -2,7 +2,7 @@
 
 int main(int argc, char **argv) {
     int r;
-    if (!((r = open(argv[1], O_RDONLY)) < 0)) {
+    if (!((r = open(argv[1], O_RDONLY | O_STAT)) < 0)) {
         return -1;
     }
     if ((r = create(argv[1], FTYPE_REG)) < 0) {